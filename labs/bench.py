@@ -0,0 +1,298 @@
+import argparse
+import csv
+import datetime
+import glob
+import json
+import os
+import platform
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# Build every engine of the labs and run it over the inputs in data.
+# Each engine and input pair is run a few times first to warm the
+# caches and then a number of timed trials. The flow it prints is
+# checked against the .ans file. For each phase the median, the 10th
+# and 90th percentiles and the extremes are kept. The phases are the
+# wall time of the whole process, and the "phase NAME: X ms" lines the
+# engines print on stderr with -v (parse, build, solve and teardown).
+# With --stats the engines are built with -DSTATS=1 and the "stat NAME:
+# X" lines of the last trial are kept as well, in engines which have
+# them (lab3 and lab4). With --perf PREFLOW_PERF=1 is set and the
+# "perf NAME: ..." lines of the last trial are kept, with the perf
+# counters of each kind of span in lab3 and lab4. The "memory NAME: B"
+# lines the engines print with -v are kept from the last trial as well,
+# with the bytes of each part of the graph, the work buffers and the
+# peak resident size. The results are written as JSON and/or CSV, so
+# that runs on different days can be compared.
+#
+# usage: python3 bench.py [-e engine,...] [-d glob,...] [-t threads]
+#                         [-w warmup] [-n trials] [--timeout s]
+#                         [--stats] [--perf] [--json file] [--csv file] [-- engine args]
+#
+# e.g. python3 bench.py -e lab3,lab4 -d "big/*.in" -t 4 --json out.json
+
+labs = os.path.dirname(os.path.abspath(__file__))
+
+# name: sources relative to labs, extra gcc flags and engine arguments
+engines = {
+    "lab0": (["lab0/preflow.c", "common/timebase.c"], [], ["-v"]),
+    "lab2": (["lab2/c/preflow.c", "common/timebase.c"], ["-pthread"], ["-v"]),
+    "lab3": (["lab3/preflow.c", "lab3/pthread_barrier.c", "common/timebase.c", "common/trace.c"],
+             ["-std=gnu18", "-pthread"], ["-v"]),
+    "lab4": (["lab4/preflow.c", "lab4/pthread_barrier.c", "common/timebase.c", "common/trace.c"],
+             ["-pthread"], ["-v"]),
+    "lab4-owner": (["lab4/preflow_owner.c", "common/timebase.c"], ["-pthread"], ["-v"]),
+    "lab6": (["lab6/c/preflow.c", "lab6/c/pthread_barrier.c", "common/timebase.c"],
+             ["-pthread", "-fgnu-tm"], ["-v"]),
+    "forsete": (["forsete/main.c", "forsete/preflow.c", "common/timebase.c"], ["-pthread"], ["-v"]),
+    "forsete-atomic": (["forsete/main.c", "forsete/preflow_barriers_atomic.c", "common/timebase.c"],
+                       ["-pthread"], ["-v"]),
+}
+
+data = ["tiny/*.in", "railwayplanning/*/*.in", "big/*.in", "huge/*.in", "skew/*.in", "gen/*.in"]
+
+phase_line = re.compile(r"^phase (\w+): ([0-9.]+) ms$")
+stat_line = re.compile(r"^stat (\w+): ([0-9.]+)( ms)?$")
+perf_line = re.compile(r"^perf ([\w ]+): (\d+) threads, (\d+) spans, ([0-9.]+) ms(.*)$")
+perf_count = re.compile(r", ([\w-]+) ([0-9.]+)")
+memory_line = re.compile(r"^memory (\w+): (\d+)")
+flow_line = re.compile(r"^f = (-?\d+)$", re.MULTILINE)
+
+
+def percentile(xs, p):
+    # Nearest rank on the sorted trials, which is one of the trials
+    xs = sorted(xs)
+    k = max(0, min(len(xs) - 1, int(round(p / 100.0 * (len(xs) - 1)))))
+    return xs[k]
+
+
+def summary(xs):
+    s = {
+        "median": statistics.median(xs),
+        "p10": percentile(xs, 10),
+        "p90": percentile(xs, 90),
+        "min": min(xs),
+        "max": max(xs),
+    }
+    return {k: round(v, 3) for k, v in s.items()}
+
+
+def build(name, outdir, stats):
+    sources, flags, _ = engines[name]
+    exe = os.path.join(outdir, name)
+    cmd = ["gcc", "-g", "-O3", "-I", os.path.join(labs, "common"), "-o", exe]
+    cmd += [os.path.join(labs, s) for s in sources] + flags
+    if stats:
+        cmd.append("-DSTATS=1")
+    r = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if r.returncode != 0:
+        sys.stderr.write("bench: cannot build %s, skipped:\n%s" % (name, r.stdout))
+        return None
+    return exe
+
+
+def run(cmd, path, env, timeout):
+    # Returns the flow, the phases in ms, the stats, the perf counts and
+    # the memory, or None and why not
+    with open(path) as f:
+        begin = time.perf_counter()
+        try:
+            r = subprocess.run(cmd, stdin=f, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                               env=env, timeout=timeout, text=True)
+        except subprocess.TimeoutExpired:
+            return None, None, None, None, None, "timeout"
+        wall = (time.perf_counter() - begin) * 1e3
+
+    if r.returncode != 0:
+        return None, None, None, None, None, "exit %d" % r.returncode
+
+    m = flow_line.search(r.stdout)
+    if m is None:
+        return None, None, None, None, None, "no flow"
+
+    phases = {"wall": wall}
+    stats = {}
+    perf = {}
+    memory = {}
+    for line in r.stderr.splitlines():
+        p = phase_line.match(line)
+        if p is not None:
+            phases[p.group(1)] = float(p.group(2))
+        p = stat_line.match(line)
+        if p is not None:
+            stats[p.group(1)] = float(p.group(2)) if p.group(3) else int(p.group(2))
+        p = perf_line.match(line)
+        if p is not None:
+            kind = {"threads": int(p.group(2)), "spans": int(p.group(3)), "ms": float(p.group(4))}
+            for name, x in perf_count.findall(p.group(5)):
+                kind[name] = float(x) if "." in x else int(x)
+            perf[p.group(1)] = kind
+        p = memory_line.match(line)
+        if p is not None:
+            memory[p.group(1)] = int(p.group(2))
+
+    return int(m.group(1)), phases, stats, perf, memory, None
+
+
+def bench(name, exe, path, args):
+    ans = os.path.splitext(path)[0] + ".ans"
+    expect = int(open(ans).read().split()[0]) if os.path.exists(ans) else None
+
+    env = dict(os.environ)
+    cmd = [exe] + engines[name][2] + args.args
+    if args.threads is not None:
+        env["PREFLOW_THREADS"] = str(args.threads)
+    if args.perf:
+        env["PREFLOW_PERF"] = "1"
+
+    result = {
+        "engine": name,
+        "input": os.path.relpath(path, os.path.join(labs, "data")),
+        "threads": args.threads,
+        "expected": expect,
+        "flow": None,
+        "status": "ok",
+        "trials": 0,
+        "phases": {},
+        "stats": {},
+        "perf": {},
+        "memory": {},
+    }
+
+    times = {}
+
+    for i in range(args.warmup + args.trials):
+        f, phases, stats, perf, memory, error = run(cmd, path, env, args.timeout)
+
+        if error is None and expect is not None and f != expect:
+            error = "wrong flow"
+
+        if error is not None:
+            result["status"] = error
+            result["flow"] = f
+            break
+
+        result["flow"] = f
+        result["stats"] = stats
+        result["perf"] = perf
+        result["memory"] = memory
+
+        if i >= args.warmup:
+            result["trials"] += 1
+            for p, ms in phases.items():
+                times.setdefault(p, []).append(ms)
+
+    for p, xs in times.items():
+        result["phases"][p] = summary(xs)
+
+    return result
+
+
+def inputs(patterns):
+    paths = []
+    for p in patterns:
+        paths += sorted(glob.glob(os.path.join(labs, "data", p)))
+    return paths
+
+
+def git_commit():
+    try:
+        r = subprocess.run(["git", "-C", labs, "rev-parse", "HEAD"], stdout=subprocess.PIPE,
+                           stderr=subprocess.DEVNULL, text=True)
+        return r.stdout.strip() or None
+    except OSError:
+        return None
+
+
+def write_csv(path, results):
+    with open(path, "w", newline="") as f:
+        w = csv.writer(f)
+        w.writerow(["engine", "input", "threads", "status", "trials", "phase",
+                    "median_ms", "p10_ms", "p90_ms", "min_ms", "max_ms"])
+        for r in results:
+            if not r["phases"]:
+                w.writerow([r["engine"], r["input"], r["threads"], r["status"], r["trials"],
+                            "", "", "", "", "", ""])
+            for p, s in r["phases"].items():
+                w.writerow([r["engine"], r["input"], r["threads"], r["status"], r["trials"], p,
+                            "%.3f" % s["median"], "%.3f" % s["p10"], "%.3f" % s["p90"],
+                            "%.3f" % s["min"], "%.3f" % s["max"]])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="benchmark the preflow engines")
+    parser.add_argument("-e", "--engines", default=",".join(engines),
+                        help="comma separated engines (default all: %(default)s)")
+    parser.add_argument("-d", "--data", default=",".join(data),
+                        help="comma separated globs under data (default %(default)s)")
+    parser.add_argument("-t", "--threads", type=int, default=None,
+                        help="PREFLOW_THREADS for the engines (default theirs)")
+    parser.add_argument("-w", "--warmup", type=int, default=1, help="untimed runs first")
+    parser.add_argument("-n", "--trials", type=int, default=5, help="timed runs")
+    parser.add_argument("--timeout", type=float, default=60, help="seconds per run")
+    parser.add_argument("--stats", action="store_true",
+                        help="build with -DSTATS=1 and keep the operation counts")
+    parser.add_argument("--perf", action="store_true",
+                        help="set PREFLOW_PERF=1 and keep the perf counts of each kind of span")
+    parser.add_argument("--json", help="write the results as JSON to this file")
+    parser.add_argument("--csv", help="write one row per phase as CSV to this file")
+    parser.add_argument("args", nargs="*", help="more arguments for every engine, after --")
+    args = parser.parse_args()
+
+    names = args.engines.split(",")
+    for name in names:
+        if name not in engines:
+            parser.error("unknown engine %s: use %s" % (name, ",".join(engines)))
+
+    paths = inputs(args.data.split(","))
+    if not paths:
+        parser.error("no inputs match %s" % args.data)
+
+    outdir = tempfile.mkdtemp(prefix="bench")
+    results = []
+
+    try:
+        for name in names:
+            exe = build(name, outdir, args.stats)
+            if exe is None:
+                continue
+            for path in paths:
+                r = bench(name, exe, path, args)
+                results.append(r)
+                wall = r["phases"].get("wall")
+                print("%-15s %-32s %-10s %10s ms" % (
+                    name, r["input"], r["status"],
+                    "%.1f" % wall["median"] if wall is not None else "-"), flush=True)
+    finally:
+        shutil.rmtree(outdir)
+
+    report = {
+        "date": datetime.datetime.now().isoformat(timespec="seconds"),
+        "commit": git_commit(),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "cpus": os.cpu_count(),
+        "warmup": args.warmup,
+        "trials": args.trials,
+        "results": results,
+    }
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+
+    if args.csv:
+        write_csv(args.csv, results)
+
+    failed = [r for r in results if r["status"] != "ok"]
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
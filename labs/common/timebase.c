@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "timebase.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+/* timebase_sec counts from the first of three sources which works:
+ *
+ *	mftb	the timebase register on Power, ticking at the timebase
+ *		frequency in /proc/cpuinfo.
+ *
+ *	tsc	the time stamp counter on x86, if the cpu says it is
+ *		invariant, i.e. ticks at a constant rate in all power
+ *		states. its rate is measured against the clock below.
+ *
+ *	clock	clock_gettime(CLOCK_MONOTONIC_RAW) anywhere else.
+ *
+ */
+
+enum { TIMEBASE_NONE, TIMEBASE_MFTB, TIMEBASE_TSC, TIMEBASE_CLOCK };
+
+static int			source = TIMEBASE_NONE;
+static double			tick;	/* seconds per tick.		*/
+static unsigned long long	timebase_frequency;
+
+int				phase_verbose;
+
+#if defined(__powerpc__) || defined(__powerpc64__)
+static unsigned long long tbr64(void)
+{
+#if defined(__powerpc64__)
+	unsigned long long	x;
+
+	__asm__ __volatile__ ("mftb %0" : "=r" (x));
+
+	return x;
+#else
+	unsigned int		hi;
+	unsigned int		lo;
+	unsigned int		hi2;
+
+	/* read the upper half again in case the lower wrapped. */
+
+	do {
+		__asm__ __volatile__ ("mftbu %0" : "=r" (hi));
+		__asm__ __volatile__ ("mftb %0" : "=r" (lo));
+		__asm__ __volatile__ ("mftbu %0" : "=r" (hi2));
+	} while (hi != hi2);
+
+	return (unsigned long long) hi << 32 | lo;
+#endif
+}
+
+static void read_cpuinfo(void)
+{
+	FILE*		fp;
+	char*		file = "/proc/cpuinfo";
+	char		line[BUFSIZ];
+	char*		s;
+
+	errno = 0;
+
+	fp = fopen(file, "r");
+
+	if (fp == NULL) {
+		fprintf(stderr, "cannot open \"%s\" for reading: ", file);
+		perror(0);
+		fprintf(stderr, "\n");
+	} else {
+		while (fgets(line, BUFSIZ, fp) != NULL) {
+			if (strncmp(line, "timebase", 8) == 0
+				&& (s = strchr(line, ':')) != NULL) {
+
+				s += 1; /* skip ':' */
+
+				while (!isdigit(*s) && *s != 0)
+					s += 1;
+
+				if (!isdigit(*s)) {
+					fprintf(stderr, "expected a digit when reading %s line for timebase\n",
+						file);
+					break;
+				}
+
+				errno = 0;
+				timebase_frequency = atoll(s);
+				if (errno != 0) {
+					fprintf(stderr, "could not read timebase value from input: %s\n", s);
+					timebase_frequency = 0;
+				}
+			}
+		}
+
+		fclose(fp);
+	}
+}
+#endif
+
+static double clock_sec(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static int invariant_tsc(void)
+{
+	unsigned int	a;
+	unsigned int	b;
+	unsigned int	c;
+	unsigned int	d;
+
+	/* bit 8 of edx in the advanced power management leaf. */
+
+	if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+		return 0;
+
+	return (d >> 8) & 1;
+}
+
+static void calibrate_tsc(void)
+{
+	unsigned long long	c0;
+	unsigned long long	c1;
+	double			t0;
+	double			t1;
+
+	/* count ticks during 20 ms of the raw clock. reading the clock
+	 * takes some ns, which is nothing next to 20 ms.
+	 *
+	 */
+
+	t0 = clock_sec();
+	c0 = __rdtsc();
+
+	do
+		t1 = clock_sec();
+	while (t1 - t0 < 0.02);
+
+	c1 = __rdtsc();
+
+	tick = (t1 - t0) / (c1 - c0);
+	timebase_frequency = 1 / tick;
+}
+#endif
+
+void init_timebase(void)
+{
+	source = TIMEBASE_CLOCK;
+
+#if defined(__powerpc__) || defined(__powerpc64__)
+	read_cpuinfo();
+
+	if (timebase_frequency > 0) {
+		tick = 1.0 / timebase_frequency;
+		source = TIMEBASE_MFTB;
+	}
+#elif defined(__x86_64__) || defined(__i386__)
+	if (invariant_tsc()) {
+		calibrate_tsc();
+		source = TIMEBASE_TSC;
+	}
+#endif
+}
+
+static unsigned long long timebase(void)
+{
+	switch (source) {
+#if defined(__powerpc__) || defined(__powerpc64__)
+	case TIMEBASE_MFTB:
+		return tbr64();
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+	case TIMEBASE_TSC:
+		return __rdtsc();
+#endif
+
+	default:
+		return clock_sec() * 1e9;
+	}
+}
+
+double timebase_sec(void)
+{
+	if (source == TIMEBASE_NONE)
+		init_timebase();
+
+	if (source == TIMEBASE_CLOCK)
+		return clock_sec();
+
+	return timebase() * tick;
+}
+
+const char* timebase_name(void)
+{
+	if (source == TIMEBASE_NONE)
+		init_timebase();
+
+	switch (source) {
+	case TIMEBASE_MFTB:
+		return "mftb";
+
+	case TIMEBASE_TSC:
+		return "tsc";
+
+	default:
+		return "clock";
+	}
+}
+
+void phase_end(phase_t* p)
+{
+	phase_print(p->name, timebase_sec() - p->begin);
+	p->done = 1;
+}
+
+void phase_print(const char* name, double sec)
+{
+	if (phase_verbose)
+		fprintf(stderr, "phase %s: %.3f ms\n", name, sec * 1e3);
+}
+
+void memory_print(const char* name, size_t bytes, long n, long m)
+{
+	if (!phase_verbose)
+		return;
+
+	fprintf(stderr, "memory %s: %zu bytes, %.1f per node, %.1f per edge\n", name, bytes,
+		n > 0 ? (double) bytes / n : 0.0, m > 0 ? (double) bytes / m : 0.0);
+}
+
+void memory_peak(void)
+{
+	struct rusage	usage;
+	FILE*		fp;
+	char		line[128];
+	long		kb;
+
+	/* the high water mark of the resident set in kilobytes. ru_maxrss
+	 * is kept across exec on linux, so a small program started by a
+	 * large one would have the size of that one, which VmHWM is not.
+	 *
+	 */
+
+	if (!phase_verbose)
+		return;
+
+	kb = -1;
+
+	fp = fopen("/proc/self/status", "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof line, fp) != NULL)
+			if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+				break;
+		fclose(fp);
+	}
+
+	if (kb < 0 && getrusage(RUSAGE_SELF, &usage) == 0)
+		kb = usage.ru_maxrss;
+
+	if (kb >= 0)
+		fprintf(stderr, "memory peak_rss: %ld bytes\n", kb * 1024);
+}
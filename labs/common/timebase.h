@@ -0,0 +1,45 @@
+#include <stddef.h>
+
+void init_timebase(void);
+double timebase_sec(void);
+const char* timebase_name(void);
+
+/* a phase of a program, such as reading the input, timed with the
+ * timebase. with phase_verbose set, phase_end prints
+ *
+ *	phase NAME: X ms
+ *
+ * on stderr. PHASE(name) { ... } times the block after it, which must
+ * not be left with break, return or goto.
+ *
+ */
+
+typedef struct phase_t phase_t;
+
+struct phase_t {
+	const char*	name;
+	double		begin;	/* timebase_sec() at the start.	*/
+	int		done;
+};
+
+extern int phase_verbose;
+
+void phase_end(phase_t* p);
+void phase_print(const char* name, double sec);
+
+#define PHASE(name)	for (phase_t phase_ = { name, timebase_sec(), 0 }; !phase_.done; phase_end(&phase_), phase_.done = 1)
+
+/* with phase_verbose set, memory_print prints what a part of the graph
+ * or of the work of an engine takes, in all and per node and edge of
+ * the input, and memory_peak the most memory the process has had
+ * resident, as
+ *
+ *	memory NAME: B bytes, X per node, Y per edge
+ *	memory peak_rss: B bytes
+ *
+ * on stderr.
+ *
+ */
+
+void memory_print(const char* name, size_t bytes, long n, long m);
+void memory_peak(void);
@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "timebase.h"
+#include "trace.h"
+
+#define CACHE_LINE	64	/* bytes in a cache block.	*/
+
+static char*		file;		/* where the trace goes.	*/
+static int		perf;		/* count with perf_event_open.	*/
+static int		opened;		/* trace_exit is registered.	*/
+static double		origin;		/* time zero of the trace.	*/
+static trace_t*		thread[TRACE_THREADS];
+
+/* the counters each thread tries to open. cache misses are those of
+ * the last level. context switches are counted by the kernel, which
+ * tells when a thread slept waiting for another.
+ *
+ */
+
+static struct {
+	const char*		name;
+	unsigned int		type;
+	unsigned long long	config;
+} counter[TRACE_COUNTERS] = {
+	{ "cycles",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_INSTRUCTIONS },
+	{ "l1d-misses",		PERF_TYPE_HW_CACHE,	PERF_COUNT_HW_CACHE_L1D
+		| PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+	{ "llc-misses",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch-misses",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_BRANCH_MISSES },
+	{ "context-switches",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static int open_counter(trace_t* t, int i, int exclude_kernel)
+{
+	struct perf_event_attr	attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = counter[i].type;
+	attr.config = counter[i].config;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP
+		| PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	/* the calling thread on any cpu, in the group of the first. */
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1,
+		t->ncounter > 0 ? t->fd[0] : -1, 0);
+}
+
+static void open_counters(trace_t* t)
+{
+	int		fd;
+	int		i;
+
+	for (i = 0; i < t->ncounter; i += 1)
+		close(t->fd[i]);
+
+	t->ncounter = 0;
+
+	for (i = 0; i < TRACE_COUNTERS; i += 1) {
+		fd = -1;
+		if (counter[i].type == PERF_TYPE_SOFTWARE)
+			fd = open_counter(t, i, 0);
+		if (fd < 0)
+			fd = open_counter(t, i, 1);
+
+		/* the main thread opens its counters first and tells
+		 * which are missing. the workers will miss the same.
+		 *
+		 */
+
+		if (fd < 0) {
+			if (t->tid == 0)
+				fprintf(stderr, "perf: no %s: %s\n", counter[i].name, strerror(errno));
+			continue;
+		}
+
+		t->fd[t->ncounter] = fd;
+		t->counter[t->ncounter] = i;
+		t->ncounter += 1;
+	}
+}
+
+static int read_counters(trace_t* t, unsigned long long* value)
+{
+	unsigned long long	buf[3 + TRACE_COUNTERS];
+	ssize_t			size;
+
+	/* the number of counters, for how long the group existed and
+	 * for how long it counted, which is less if the kernel had to
+	 * take turns with other groups, and then the counts.
+	 *
+	 */
+
+	size = (3 + t->ncounter) * sizeof buf[0];
+
+	if (read(t->fd[0], buf, size) != size)
+		return 0;
+
+	if (buf[2] < buf[1])
+		t->multiplexed = 1;
+
+	memcpy(value, buf + 3, t->ncounter * sizeof buf[0]);
+
+	return 1;
+}
+
+void trace_start(trace_t* t)
+{
+	read_counters(t, t->last);
+}
+
+void trace_count(trace_t* t, const char* name, double sec)
+{
+	unsigned long long	now[TRACE_COUNTERS];
+	trace_kind_t*		k;
+	int			i;
+
+	if (!read_counters(t, now))
+		return;
+
+	/* the last kind also takes the spans of names beyond it. */
+
+	for (k = t->kind; k < t->kind + TRACE_KINDS - 1; k += 1)
+		if (k->name == NULL || strcmp(k->name, name) == 0)
+			break;
+
+	if (k->name == NULL)
+		k->name = name;
+
+	k->spans += 1;
+	k->sec += sec;
+
+	for (i = 0; i < t->ncounter; i += 1) {
+		k->count[i] += now[i] - t->last[i];
+		t->last[i] = now[i];
+	}
+}
+
+static void trace_write(void)
+{
+	FILE*		fp;
+	trace_t*	t;
+	trace_event_t*	e;
+	unsigned long	i;
+	unsigned long	first;
+	unsigned long	spans;
+	unsigned long	lost;
+	int		tid;
+	const char*	sep;
+
+	fp = fopen(file, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "trace: cannot open \"%s\" for writing: ", file);
+		perror(0);
+		return;
+	}
+
+	/* the times are in microseconds from trace_open. a thread whose
+	 * ring buffer went round has only its last spans.
+	 *
+	 */
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+		"\"args\":{\"name\":\"preflow\"}}");
+
+	spans = 0;
+	lost = 0;
+	sep = ",\n";
+
+	for (tid = 0; tid < TRACE_THREADS; tid += 1) {
+		t = thread[tid];
+		if (t == NULL)
+			continue;
+
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"name\":\"%s\"}}", sep, tid, t->name);
+		fprintf(fp, "%s{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"sort_index\":%d}}", sep, tid, tid);
+
+		first = t->n > TRACE_EVENTS ? t->n - TRACE_EVENTS : 0;
+		lost += first;
+
+		for (i = first; i < t->n; i += 1) {
+			e = &t->event[i % TRACE_EVENTS];
+			fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"round\":%ld}}",
+				sep, e->name, tid, (e->begin - origin) * 1e6,
+				(e->end - e->begin) * 1e6, e->round);
+			spans += 1;
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "trace: cannot write \"%s\": ", file);
+		perror(0);
+		return;
+	}
+
+	fprintf(stderr, "trace: %lu spans in %s", spans, file);
+	if (lost > 0)
+		fprintf(stderr, ", %lu older ones overwritten", lost);
+	fprintf(stderr, "\n");
+}
+
+static void perf_report(void)
+{
+	trace_kind_t	sum[TRACE_KINDS];
+	int		threads[TRACE_KINDS];
+	int		has[TRACE_COUNTERS];
+	trace_t*	t;
+	trace_kind_t*	k;
+	int		multiplexed;
+	int		tid;
+	int		i;
+	int		j;
+	int		c;
+
+	/* add up the kinds of all threads by name, in the order they
+	 * first appear, which puts those of the main thread first.
+	 *
+	 */
+
+	memset(sum, 0, sizeof sum);
+	memset(threads, 0, sizeof threads);
+	memset(has, 0, sizeof has);
+	multiplexed = 0;
+
+	for (tid = 0; tid < TRACE_THREADS; tid += 1) {
+		t = thread[tid];
+		if (t == NULL || t->ncounter == 0)
+			continue;
+
+		multiplexed |= t->multiplexed;
+
+		for (i = 0; i < TRACE_KINDS && t->kind[i].name != NULL; i += 1) {
+			for (j = 0; j < TRACE_KINDS - 1; j += 1)
+				if (sum[j].name == NULL || strcmp(sum[j].name, t->kind[i].name) == 0)
+					break;
+
+			k = &sum[j];
+			k->name = t->kind[i].name;
+			k->spans += t->kind[i].spans;
+			k->sec += t->kind[i].sec;
+			threads[j] += 1;
+
+			for (c = 0; c < t->ncounter; c += 1) {
+				k->count[t->counter[c]] += t->kind[i].count[c];
+				has[t->counter[c]] = 1;
+			}
+		}
+	}
+
+	if (sum[0].name == NULL) {
+		fprintf(stderr, "perf: no counters could be opened\n");
+		return;
+	}
+
+	for (j = 0; j < TRACE_KINDS && sum[j].name != NULL; j += 1) {
+		k = &sum[j];
+		fprintf(stderr, "perf %s: %d threads, %ld spans, %.3f ms",
+			k->name, threads[j], k->spans, k->sec * 1e3);
+
+		for (c = 0; c < TRACE_COUNTERS; c += 1)
+			if (has[c])
+				fprintf(stderr, ", %s %llu", counter[c].name, k->count[c]);
+
+		if (has[0] && has[1] && k->count[0] > 0)
+			fprintf(stderr, ", ipc %.2f", (double) k->count[1] / k->count[0]);
+
+		fprintf(stderr, "\n");
+	}
+
+	if (multiplexed)
+		fprintf(stderr, "perf: the counters were shared with others for some time, "
+			"so their counts are too low\n");
+}
+
+static void trace_exit(void)
+{
+	int		tid;
+	int		i;
+
+	if (perf)
+		perf_report();
+
+	if (file != NULL)
+		trace_write();
+
+	for (tid = 0; tid < TRACE_THREADS; tid += 1) {
+		if (thread[tid] == NULL)
+			continue;
+		for (i = 0; i < thread[tid]->ncounter; i += 1)
+			close(thread[tid]->fd[i]);
+		free(thread[tid]);
+	}
+
+	free(file);
+}
+
+void trace_open(const char* name, int count)
+{
+	/* a second call, as when preflow is called again, keeps adding
+	 * to the same trace.
+	 *
+	 */
+
+	if (name != NULL && file == NULL) {
+		file = strdup(name);
+		if (file == NULL) {
+			fprintf(stderr, "trace: out of memory\n");
+			exit(1);
+		}
+	}
+
+	if (count)
+		perf = 1;
+
+	if ((file != NULL || perf) && !opened) {
+		origin = timebase_sec();
+		atexit(trace_exit);
+		opened = 1;
+	}
+}
+
+trace_t* trace_thread(int tid, const char* name)
+{
+	trace_t*	t;
+	size_t		size;
+
+	if ((file == NULL && !perf) || tid < 0 || tid >= TRACE_THREADS)
+		return NULL;
+
+	/* each thread asks for its own tid, so no lock is needed. */
+
+	t = thread[tid];
+	if (t == NULL) {
+		size = (sizeof(trace_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+		t = aligned_alloc(CACHE_LINE, size);
+		if (t == NULL) {
+			fprintf(stderr, "trace: out of memory\n");
+			exit(1);
+		}
+		memset(t, 0, offsetof(trace_t, event));
+		t->tid = tid;
+		thread[tid] = t;
+	}
+
+	snprintf(t->name, sizeof t->name, "%s", name);
+	t->record = file != NULL;
+
+	/* counters count for the thread which opened them, so a new
+	 * thread with the same tid opens new ones.
+	 *
+	 */
+
+	if (perf)
+		open_counters(t);
+
+	return t;
+}
@@ -0,0 +1,109 @@
+/* a trace of what each thread does, as spans of time with a name and
+ * the round they belong to. it is written at exit in the trace event
+ * format of chrome, so that it can be opened in chrome://tracing or
+ * https://ui.perfetto.dev with one line per thread.
+ *
+ * each thread has its own ring buffer with the last TRACE_EVENTS
+ * spans, so a span costs reading the timebase and a few stores and no
+ * thread ever waits for another. when trace_open has been given
+ * neither a file nor perf, trace_thread returns NULL and nothing is
+ * recorded. it needs timebase.h before it.
+ *
+ * with perf, each thread also opens counters of the cpu for itself
+ * with perf_event_open, and what they count from trace_time to
+ * trace_span is added up by the name of the span. the sums over all
+ * threads are printed on stderr at exit as
+ *
+ *	perf NAME: T threads, X ms, cycles C, instructions I, ...
+ *
+ * a counter which cannot be opened, as the hardware ones in most
+ * virtual machines, is left out. with perf the spans of a thread must
+ * not overlap, since trace_time starts the counting of the next one.
+ *
+ *	trace_t*	t = trace_thread(1, "worker 0");
+ *	double		begin = trace_time(t);
+ *
+ *	...
+ *
+ *	trace_span(t, "discharge", begin, round);
+ *
+ */
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS	(1 << 16)	/* spans kept per thread.	*/
+#endif
+#define TRACE_THREADS	1025		/* threads with a buffer.	*/
+#define TRACE_COUNTERS	6		/* perf counters per thread.	*/
+#define TRACE_KINDS	16		/* span names counted apart.	*/
+
+typedef struct trace_event_t	trace_event_t;
+typedef struct trace_kind_t	trace_kind_t;
+typedef struct trace_t		trace_t;
+
+struct trace_event_t {
+	const char*	name;	/* a string which lives until exit.	*/
+	double		begin;	/* timebase_sec() at the start.		*/
+	double		end;	/* timebase_sec() at the end.		*/
+	long		round;
+};
+
+struct trace_kind_t {
+	const char*		name;	/* of the spans, NULL if unused. */
+	long			spans;
+	double			sec;
+	unsigned long long	count[TRACE_COUNTERS];
+};
+
+struct trace_t {
+	char			name[32];	/* of the thread.	*/
+	int			tid;
+	int			record;		/* keep spans for a file. */
+	unsigned long		n;		/* spans ever recorded.	*/
+	int			ncounter;	/* counters in the group. */
+	int			fd[TRACE_COUNTERS];	/* fd[0] leads.	*/
+	int			counter[TRACE_COUNTERS];	/* which.	*/
+	unsigned long long	last[TRACE_COUNTERS];	/* at trace_time. */
+	int			multiplexed;	/* did not always count. */
+	trace_kind_t		kind[TRACE_KINDS];
+	trace_event_t		event[TRACE_EVENTS];
+};
+
+void trace_open(const char* file, int perf);
+trace_t* trace_thread(int tid, const char* name);
+void trace_start(trace_t* t);
+void trace_count(trace_t* t, const char* name, double sec);
+
+static inline double trace_time(trace_t* t)
+{
+	if (t == NULL)
+		return 0;
+
+	if (t->ncounter > 0)
+		trace_start(t);
+
+	return timebase_sec();
+}
+
+static inline void trace_span(trace_t* t, const char* name, double begin, long round)
+{
+	trace_event_t*	e;
+	double		end;
+
+	if (t == NULL)
+		return;
+
+	end = timebase_sec();
+
+	if (t->ncounter > 0)
+		trace_count(t, name, end - begin);
+
+	if (!t->record)
+		return;
+
+	e = &t->event[t->n % TRACE_EVENTS];
+	e->name = name;
+	e->begin = begin;
+	e->end = end;
+	e->round = round;
+	t->n += 1;
+}
@@ -0,0 +1,100 @@
+/* a main for the files in this directory, in place of the one forsete
+ * links them with: it reads a graph in the format of the labs from
+ * stdin, calls preflow with node 0 as the source and n-1 as the sink,
+ * and prints the flow as preflow.c in the labs does. the number of
+ * threads is taken from PREFLOW_THREADS as on forsete. -v prints how
+ * long each phase takes, where solve includes making the graph since
+ * preflow does that.
+ *
+ *	gcc -O3 -I../common -o preflow main.c preflow.c ../common/timebase.c -pthread
+ *
+ * or, to write a trace to the file in PREFLOW_TRACE,
+ *
+ *	gcc -O3 -DTRACE -I../common -o preflow main.c preflow.c \
+ *		../common/timebase.c ../common/trace.c -pthread
+ *
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "timebase.h"
+
+typedef struct xedge_t	xedge_t;
+
+struct xedge_t {
+	int		u;	/* one of the two nodes.	*/
+	int		v;	/* the other. 			*/
+	int		c;	/* capacity.			*/
+};
+
+int preflow(int n, int m, int s, int t, xedge_t* e);
+
+static int next_int()
+{
+	int	x;
+	int	c;
+
+	x = 0;
+	while (isdigit(c = getchar()))
+		x = 10 * x + c - '0';
+
+	return x;
+}
+
+int main(int argc, char* argv[])
+{
+	xedge_t*	e;	/* the m edges.			*/
+	int		n;	/* number of nodes.		*/
+	int		m;	/* number of edges.		*/
+	int		i;
+	int		f;
+	int		c;
+
+	while ((c = getopt(argc, argv, "v")) != -1) {
+		if (c != 'v') {
+			fprintf(stderr, "usage: %s [-v] < input\n", argv[0]);
+			exit(1);
+		}
+		phase_verbose = 1;
+	}
+
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
+
+	n = next_int();
+	m = next_int();
+
+	/* skip C and P from the 6railwayplanning lab in EDAF05 */
+	next_int();
+	next_int();
+
+	e = malloc(m * sizeof(xedge_t));
+	if (e == NULL) {
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		exit(1);
+	}
+
+	PHASE("parse") {
+		for (i = 0; i < m; i += 1) {
+			e[i].u = next_int();
+			e[i].v = next_int();
+			e[i].c = next_int();
+		}
+	}
+
+	PHASE("solve") {
+		f = preflow(n, m, 0, n - 1, e);
+	}
+
+	printf("f = %d\n", f);
+
+	PHASE("teardown") {
+		free(e);
+	}
+
+	return 0;
+}
@@ -2,6 +2,8 @@
 Lab 3 implementation with work objects
 */
  
+#define _GNU_SOURCE
+
 #include <alloca.h>
 #include <ctype.h>
 #include <stdarg.h>
@@ -10,10 +12,31 @@ Lab 3 implementation with work objects
 #include <string.h>
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <unistd.h>
 
 #define PRINT	0	/* enable/disable prints. */
 
+/* compiled with -DTRACE, and linked with trace.c and timebase.c in
+ * labs/common, what each thread does in each round is written at exit
+ * to the file named by PREFLOW_TRACE, and with PREFLOW_PERF=1 the perf
+ * counters of each kind of span are printed, see trace.h. without it
+ * this file needs nothing else, as when it is sent to forsete.
+ *
+ */
+
+#ifdef TRACE
+#include "timebase.h"
+#include "trace.h"
+#else
+typedef struct trace_t trace_t;
+#define trace_open(file, perf)		((void) (file), (void) (perf))
+#define trace_thread(tid, name)		((void) (name), (trace_t*) NULL)
+#define trace_time(t)			((void) (t), 0.0)
+#define trace_span(t, name, begin, round)	((void) (begin), (void) (round))
+#endif
+
 /* the funny do-while next clearly performs one iteration of the loop.
  * if you are really curious about why there is a loop, please check
  * the course book about the C preprocessor where it is explained. it
@@ -52,13 +75,9 @@ typedef struct node_t	node_t;
 typedef struct edge_t	edge_t;
 typedef struct list_t	list_t;
 typedef struct worker_t worker_t;
-typedef struct work_t work_t;
 typedef struct push_t push_t;
 typedef struct relabel_t relabel_t;
-typedef enum WORK_TYPE {
-	WORK_PUSH,
-	WORK_RELABEL
-} work_type;
+typedef struct buffer_t buffer_t;
 
 struct list_t {
 	edge_t*		edge;
@@ -71,6 +90,7 @@ struct node_t {
 	list_t*		edge;	/* adjacency list.		*/
 	node_t*		next;	/* with excess preflow.		*/
 	int 		in_queue;
+	int			degree;	/* arcs in adjacency list.	*/
 };
 
 struct edge_t {
@@ -85,11 +105,28 @@ struct graph_t {
 	int		m;	/* edges.			*/
 	int    	nthreads;
 	int     totalJobs;
+	int		chunk;	/* nodes in each range of target nodes. */
 	worker_t* 	worker;
 	node_t*		v;	/* array of n nodes.		*/
 	edge_t*		e;	/* array of m edges.		*/
 	node_t*		s;	/* source.			*/
 	node_t*		t;	/* sink.			*/
+	pthread_barrier_t barrier;	/* all work created before it is applied. */
+	long		maxscan;	/* sum of the largest scanned per round. */
+	long		sumscan;	/* sum of all scanned per round. */
+};
+
+/* work of a round in contiguous arrays, one buffer for each range of
+ * g->chunk target nodes. worker i applies the buffers for range i.
+ */
+
+struct buffer_t {
+	push_t*		push;
+	int			npush;
+	int			maxpush;
+	relabel_t*	relabel;
+	int			nrelabel;
+	int			maxrelabel;
 };
 
 struct worker_t {
@@ -97,23 +134,20 @@ struct worker_t {
 	int			nbrJobs;
 	graph_t*	g;
 	node_t*		excess;	/* nodes with e > 0 except s,t.	*/
-	work_t*		work;
-};
-
-struct work_t {
-	work_type type;
-	union {
-		push_t* push;
-		relabel_t* relabel;
-	} task;
-	work_t* next;
+	buffer_t*	work;	/* nthreads buffers, one per range. */
+	node_t**	active;	/* nodes with e > 0 after the round. */
+	int			nactive;
+	int			maxactive;
+	long		load;	/* degrees given to us this round. */
+	long		scanned;	/* arcs scanned this round.	*/
+	long		total;	/* arcs scanned in all rounds.	*/
+	trace_t*	trace;	/* NULL unless tracing.		*/
 };
 
 struct push_t {
-	node_t* u;
-	node_t* v;
+	node_t* v;	/* node receiving the flow.	*/
 	edge_t* e;
-	int d;
+	int d;		/* added to e->f.		*/
 };
 
 struct relabel_t {
@@ -138,44 +172,46 @@ static graph_t* new_graph(int n, int m, int s, int t, xedge_t* e, int nthreads);
 
 static char* progname;
 
-void create_push_work(work_t** work_list, node_t* u, node_t* v, edge_t* e, int df) {
-	push_t* push_task = xmalloc(sizeof(push_t));
-	push_task->u = u;
+static void* xrealloc(void* p, size_t s);
+
+void create_push_work(buffer_t* b, node_t* v, edge_t* e, int df) {
+	if (b->npush == b->maxpush) {
+		b->maxpush = b->maxpush == 0 ? 64 : 2 * b->maxpush;
+		b->push = xrealloc(b->push, b->maxpush * sizeof(push_t));
+	}
+
+	push_t* push_task = &b->push[b->npush++];
 	push_task->v = v;
 	push_task->e = e;
 	push_task->d = df;
+}
 
-    work_t* work = xmalloc(sizeof(work_t));
-    work->type = WORK_PUSH;
-    work->task.push = push_task;
+void create_relabel_work(buffer_t* b, node_t* u) {
+	if (b->nrelabel == b->maxrelabel) {
+		b->maxrelabel = b->maxrelabel == 0 ? 64 : 2 * b->maxrelabel;
+		b->relabel = xrealloc(b->relabel, b->maxrelabel * sizeof(relabel_t));
+	}
 
-	work->next = *work_list;
-	*work_list = work;
+	b->relabel[b->nrelabel++].u = u;
 }
 
-void create_relabel_work(work_t** work_list, node_t* u) {
-	relabel_t* relabel_task = xmalloc(sizeof(relabel_t));
-	relabel_task->u = u;
+void add_active(worker_t* worker, node_t* u) {
+	if (worker->nactive == worker->maxactive) {
+		worker->maxactive = worker->maxactive == 0 ? 64 : 2 * worker->maxactive;
+		worker->active = xrealloc(worker->active, worker->maxactive * sizeof(node_t*));
+	}
 
-    work_t* work = xmalloc(sizeof(work_t));
-    work->type = WORK_RELABEL;
-    work->task.relabel = relabel_task;
-    
-	work->next = *work_list;
-	*work_list = work;
+	worker->active[worker->nactive++] = u;
 }
 
-void free_work_list(work_t* work_list) {
-	pr("freeing work list\n");
-	while (work_list != NULL) {
-		if (work_list->type == WORK_PUSH)
-			free(work_list->task.push);
-		else
-		 	free(work_list->task.relabel);
-		work_t* temp = work_list;
-		work_list = work_list->next;
-		free(temp);
+void free_work(worker_t* worker) {
+	pr("freeing work buffers\n");
+	for (int i = 0; i < worker->g->nthreads; i++) {
+		free(worker->work[i].push);
+		free(worker->work[i].relabel);
 	}
+	free(worker->work);
+	free(worker->active);
 }
 
 static int id(graph_t* g, node_t* v)
@@ -211,6 +247,226 @@ static int next_int()
         return x;
 }
 
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+/* active nodes are given to workers round robin or, by default, to
+ * the worker with the fewest arcs to scan so far in the round.
+ *
+ */
+
+enum { BALANCE_RR, BALANCE_DEGREE };
+
+static int		balance = BALANCE_DEGREE;
+
+static int parse_balance(const char* s)
+{
+	if (strcmp(s, "rr") == 0)
+		return BALANCE_RR;
+	else if (strcmp(s, "degree") == 0)
+		return BALANCE_DEGREE;
+
+	error("bad balance \"%s\": use rr or degree", s);
+
+	return BALANCE_DEGREE;
+}
+
+static const char*	trace_file;
+static int		perf;
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+
+	s = getenv("PREFLOW_BALANCE");
+	if (s != NULL)
+		balance = parse_balance(s);
+
+	trace_file = getenv("PREFLOW_TRACE");
+
+	s = getenv("PREFLOW_PERF");
+	if (s != NULL)
+		perf = strcmp(s, "0") != 0;
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+#ifdef MAIN
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:b:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'b':
+			balance = parse_balance(optarg);
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-b rr|degree] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+#endif
+
 static void* xmalloc(size_t s)
 {
 	void*		p;
@@ -235,6 +491,16 @@ static void* xcalloc(size_t n, size_t s)
 	return p;
 }
 
+static void* xrealloc(void* p, size_t s)
+{
+	p = realloc(p, s);
+
+	if (p == NULL)
+		error("out of memory: realloc(%zu) failed", s);
+
+	return p;
+}
+
 static void mutex_lock(pthread_mutex_t* m, const char* name)
 {
 	/* lock a mutex and check that it was successful.
@@ -262,6 +528,7 @@ static void add_edge(node_t* u, edge_t* e)
 	p->edge = e;
 	p->next = u->edge;
 	u->edge = p;
+	u->degree += 1;
 }
 
 static void connect(node_t* u, node_t* v, int c, edge_t* e)
@@ -279,13 +546,14 @@ static void connect(node_t* u, node_t* v, int c, edge_t* e)
 	add_edge(v, e);
 }
 
-static void push(graph_t* g, node_t* u, node_t* v, edge_t* e, int df)
+static void push(graph_t* g, node_t* v, edge_t* e, int df)
 {
 
-	pr("push from %d to %d: ", id(g, u), id(g, v));
+	/* the sender already subtracted df from its excess. */
+
+	pr("push to %d: ", id(g, v));
 	pr("f = %d, c = %d, so pushing %d\n", e->f, e->c, df);
 
-	u->e -= abs(df);
 	v->e += abs(df);
 	e->f += df;
 }
@@ -303,21 +571,136 @@ static node_t* other(node_t* u, edge_t* e)
 		return e->u;
 }
 
-static int getNextThreadIndex(graph_t* g)
+static int getNextThreadIndex(graph_t* g, node_t* u)
 {
 	int index = g->totalJobs % g->nthreads;
 	g->totalJobs += 1;
+
+	/* a worker is as late as the arcs it must scan, so give u to
+	 * the one with the fewest so far this round. ties go round robin.
+	 *
+	 */
+
+	if (balance == BALANCE_DEGREE) {
+		for (int i = 0; i < g->nthreads; i += 1)
+			if (g->worker[i].load < g->worker[index].load)
+				index = i;
+
+		g->worker[index].load += u->degree + 1;
+	}
+
 	return index;
 }
 
+static void account_round(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	long		sum;
+	int		i;
+
+	/* all workers wait so their counts for the round are final. */
+
+	max = 0;
+	sum = 0;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		w->total += w->scanned;
+		sum += w->scanned;
+		if (w->scanned > max)
+			max = w->scanned;
+		w->scanned = 0;
+		w->load = 0;
+	}
+
+	g->maxscan += max;
+	g->sumscan += sum;
+}
+
+#if PRINT || defined(TRACE)
+static void report_work(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	int		i;
+	int		k;
+
+	/* a histogram of the arcs each worker scanned, and how much
+	 * longer the rounds took than with a perfect balance, which is
+	 * the largest work of each round summed, against the mean.
+	 *
+	 */
+
+	max = 1;
+	for (i = 0; i < g->nthreads; i += 1)
+		if (g->worker[i].total > max)
+			max = g->worker[i].total;
+
+	fprintf(stderr, "arcs scanned per worker, %s assignment:\n",
+		balance == BALANCE_DEGREE ? "degree" : "round robin");
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		fprintf(stderr, "%4d %10ld ", i, w->total);
+		for (k = 0; k < 50 * w->total / max; k += 1)
+			fputc('#', stderr);
+		fputc('\n', stderr);
+	}
+
+	fprintf(stderr, "round imbalance (largest / mean): %.2f\n",
+		g->sumscan == 0 ? 1.0 : (double) g->nthreads * g->maxscan / g->sumscan);
+}
+#endif
+
+static int bucket(graph_t* g, node_t* u)
+{
+	return id(g, u) / g->chunk;
+}
+
+static void assignNodeToThread(graph_t* g, node_t* u)
+{
+	int index = getNextThreadIndex(g, u);
+	worker_t* worker = &g->worker[index];
+	u->next = worker->excess;
+	worker->excess = u;
+}
+
 static void allocateNodeToThread(graph_t* g, node_t* u)
 {
 	if (u != g->s && u != g->t && u->in_queue == 0) {
 		u->in_queue = 1;
-		int index = getNextThreadIndex(g);
-		worker_t* worker = &g->worker[index];
-		u->next = worker->excess;
-		worker->excess = u;
+		assignNodeToThread(g, u);
+	}
+}
+
+static void apply_work(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+	buffer_t*	b;
+	node_t*		v;
+	int			i;
+	int			j;
+
+	/* apply the work of all workers for nodes in our range. */
+
+	for (i = 0; i < g->nthreads; i++) {
+		b = &g->worker[i].work[worker->i];
+
+		for (j = 0; j < b->nrelabel; j++)
+			relabel(g, b->relabel[j].u);
+
+		for (j = 0; j < b->npush; j++) {
+			v = b->push[j].v;
+			push(g, v, b->push[j].e, b->push[j].d);
+			if (v != g->s && v != g->t && v->in_queue == 0) {
+				v->in_queue = 1;
+				add_active(worker, v);
+			}
+		}
+
+		b->nrelabel = 0;
+		b->npush = 0;
 	}
 }
 
@@ -332,8 +715,16 @@ void *work(void* args)
 	int		b;
 	int 	df;
 	int 	u_e; 
+	double	begin;
+	long	round;
+	char	name[32];
+
+	snprintf(name, sizeof name, "worker %d", worker->i);
+	worker->trace = trace_thread(worker->i + 1, name);
+
+	for (round = 1; ; round += 1) {
+		begin = trace_time(worker->trace);
 
-	while (1) {
 		node_t* u = worker->excess;
 		while (u != NULL) {
 			worker->nbrJobs++;
@@ -345,6 +736,7 @@ void *work(void* args)
 			while (p != NULL && u_e > 0) {
 				e = p->edge;
 				p = p->next;
+				worker->scanned += 1;
 
 				if (u == e->u) {
 					v = e->v;
@@ -359,7 +751,7 @@ void *work(void* args)
 				if (u->h == 0) {
 					//do reabel
 					pr("create relabel work for node @%d\n", id(g, u));
-					create_relabel_work(&worker->work, u);
+					create_relabel_work(&worker->work[bucket(g, u)], u);
 					pushed = 1;
 					break;
 				}
@@ -372,7 +764,7 @@ void *work(void* args)
 						df = -MIN(u_e, e->c + e->f); //This flow must be negative
 					}
 					u_e -= abs(df);
-					create_push_work(&worker->work, u, v, e, df);
+					create_push_work(&worker->work[bucket(g, v)], v, e, df);
 					pr("@T%d: create push work from node @%d to node @%d, df = %d\n", worker->i, id(g, u), id(g, v), df);
 					pushed = 1;
 				}
@@ -382,16 +774,39 @@ void *work(void* args)
 			//2. if not pushed, reabel
 			if (!pushed && u_e> 0) {
 				pr("@T%d: no push possible, relabel node @%d\n", worker->i, id(g, u));
-				create_relabel_work(&worker->work, u);
+				create_relabel_work(&worker->work[bucket(g, u)], u);
 			}
 			node_t* temp = u;
 			u = u->next;
-			temp->in_queue = 0;
 			temp->next = NULL;
+
+			/* nobody else looks at the excess of temp in this
+			 * round so what was pushed away is subtracted here.
+			 *
+			 */
+
+			temp->e = u_e;
+			if (u_e > 0)
+				add_active(worker, temp);
+			else
+				temp->in_queue = 0;
 		}
 
 		worker->excess = NULL;
 
+		trace_span(worker->trace, "discharge", begin, round);
+		begin = trace_time(worker->trace);
+
+		pthread_barrier_wait(&g->barrier);
+
+		trace_span(worker->trace, "barrier", begin, round);
+		begin = trace_time(worker->trace);
+
+		apply_work(worker);
+
+		trace_span(worker->trace, "apply", begin, round);
+		begin = trace_time(worker->trace);
+
 		pthread_mutex_lock(&mutex);
 		waitingWorkers++;
 
@@ -403,10 +818,12 @@ void *work(void* args)
 
 		if (allDone) {
 			pthread_mutex_unlock(&mutex);
+			trace_span(worker->trace, "handshake", begin, round);
 			return 0;
 		}
 
 		pthread_mutex_unlock(&mutex);
+		trace_span(worker->trace, "handshake", begin, round);
 	}
 }
 
@@ -420,12 +837,21 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 	list_t*		lp;
 	
 	graph_t*	g;
+	trace_t*	trace;
+	double		begin;
+	long		round;
 
 	allDone = 0;
 	waitingWorkers = 0;
 
 
-	int nthreads = 30;
+	read_options();
+	int nthreads = default_threads();
+
+	trace_open(trace_file, perf);
+	trace = trace_thread(0, "main");
+	begin = trace_time(trace);
+
 	g = new_graph(n, m, s, t, e, nthreads);
 	
 	ns = g->s;
@@ -439,6 +865,7 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 	lp = ns->edge;
 
 	pthread_t thread[nthreads];
+	pthread_attr_t	attr;
 
 	int totalPushed = 0;
 	int first = 1;
@@ -466,41 +893,42 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 
 
 	ns->e -= totalPushed;
+
+	pthread_barrier_init(&g->barrier, NULL, nthreads);
 	
 	// Start working threads
 	for (int i = 0; i < nthreads; i += 1) {
-		if (pthread_create(&thread[i], NULL, work, (void *) &g->worker[i])) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
 			error("pthread_create failed");
 		}
+		pthread_attr_destroy(&attr);
 	}
 
-	while(1) {
+	trace_span(trace, "start", begin, 0);
+
+	for (round = 1; ; round += 1) {
+		begin = trace_time(trace);
+
         pthread_mutex_lock(&mutex);
 		while (waitingWorkers < nthreads) {
 			pthread_cond_wait(&cond_main, &mutex);
 		}
+
+		trace_span(trace, "wait", begin, round);
+		begin = trace_time(trace);
+
+		account_round(g);
 		
-		int first = 1;
 		for (int i = 0; i < nthreads; i++) {
-			work_t* w = g->worker[i].work;
-			while (w != NULL) {
-				if (w->type == WORK_PUSH) {
-					push(g, w->task.push->u, w->task.push->v, w->task.push->e, w->task.push->d);
-					allocateNodeToThread(g, w->task.push->v);
-					if (w->task.push->u->e > 0)
-						allocateNodeToThread(g, w->task.push->u);
-					first = 0;
-				} else {
-					relabel(g, w->task.relabel->u);
-					allocateNodeToThread(g, w->task.relabel->u);
-					first = 0;
-				}
-				w = w->next;
-			}
-			free_work_list(g->worker[i].work);
-			g->worker[i].work = NULL;
+			worker_t* w = &g->worker[i];
+			for (int j = 0; j < w->nactive; j++)
+				assignNodeToThread(g, w->active[j]);
+			w->nactive = 0;
 		}
 
+		trace_span(trace, "assign", begin, round);
+
 		if (-ns->e == nt->e) {
 			allDone = 1;
 			pthread_cond_broadcast(&cond_worker);
@@ -520,7 +948,13 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 			error("pthread_join failed");
 		}
 	}
+
+	pthread_barrier_destroy(&g->barrier);
 	
+#if PRINT || defined(TRACE)
+	report_work(g);
+#endif
+
 	return nt->e;
 }
 
@@ -539,6 +973,10 @@ static void free_graph(graph_t* g)
 			p = q;
 		}
 	}
+	for (i = 0; i < g->nthreads; i += 1)
+		free_work(&g->worker[i]);
+
+	free(g->worker);
 	free(g->v);
 	free(g->e);
 	free(g);
@@ -566,11 +1004,15 @@ static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
 
 	g->totalJobs = 0;
 	g->nthreads = nthreads;
+	g->maxscan = 0;
+	g->sumscan = 0;
+	g->chunk = (n + nthreads - 1) / nthreads;
 
 	g->worker = xcalloc(nthreads, sizeof(worker_t));
 	for (int i = 0; i < nthreads; i += 1) {
 		g->worker[i].i = i;
 		g->worker[i].g = g;
+		g->worker[i].work = xcalloc(nthreads, sizeof(buffer_t));
 	}
 
 	for (i = 0; i < m; i += 1) {
@@ -631,7 +1073,7 @@ int main(int argc, char* argv[])
 	next_int();
 	next_int();
 
-	int nthreads = 2;
+	int nthreads = options(argc, argv);
 
 	g = new_graph(in, n, m, nthreads);
 
@@ -666,11 +1108,15 @@ static graph_t* new_graph(int n, int m, int s, int t, xedge_t* e, int nthreads)
 
 	g->totalJobs = 0;
 	g->nthreads = nthreads;
+	g->maxscan = 0;
+	g->sumscan = 0;
+	g->chunk = (n + nthreads - 1) / nthreads;
 
 	g->worker = xcalloc(nthreads, sizeof(worker_t));
 	for (int i = 0; i < nthreads; i += 1) {
 		g->worker[i].i = i;
 		g->worker[i].g = g;
+		g->worker[i].work = xcalloc(nthreads, sizeof(buffer_t));
 	}
 
 	for (i = 0; i < m; i += 1) {
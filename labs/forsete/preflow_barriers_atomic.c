@@ -2,15 +2,20 @@
 BARRIER + ATOMIC variables (instant relable and push in threads)
 */
  
+#define _GNU_SOURCE
+
 #include <alloca.h>
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <unistd.h>
 
 #define PRINT	0	/* enable/disable prints. */
 
@@ -28,6 +33,24 @@ BARRIER + ATOMIC variables (instant relable and push in threads)
 #define pr(...)		/* no effect at all */
 #endif
 
+#define GLOBAL	1	/* relabels per node between global relabels. */
+
+#ifndef CONTENTION
+#define CONTENTION	0	/* time atomics, see contention_t. */
+#endif
+
+#ifndef SAMPLE
+#define SAMPLE	64	/* atomic adds per timed one. */
+#endif
+
+#ifndef TOP
+#define TOP	20	/* hottest nodes printed. */
+#endif
+
+#if CONTENTION
+#include "timebase.h"
+#endif
+
 #define MIN(a,b)	(((a)<=(b))?(a):(b))
 
 /* introduce names for some structs. a struct is like a class, except
@@ -44,6 +67,8 @@ typedef struct node_t	node_t;
 typedef struct edge_t	edge_t;
 typedef struct list_t	list_t;
 typedef struct worker_t worker_t;
+typedef struct contention_t contention_t;
+typedef struct hot_t	hot_t;
 
 typedef struct xedge_t	xedge_t;
 struct xedge_t {
@@ -67,10 +92,35 @@ struct node_t {
 	list_t*		edge;	/* adjacency list.		*/
 	node_t*		next;	/* with excess preflow.		*/
 	int 		in_queue;
+	int			degree;	/* arcs in adjacency list.	*/
 	node_t*     next_delta_e;
 	atomic_flag 		has_delta_e;
 };
 
+/* how the atomics of one thread went, with -DCONTENTION=1, printed
+ * as "contention ..." lines when preflow returns. every SAMPLE:th add
+ * to an excess or a height by a thread is timed, and the time is also
+ * added to the node. the compare and swap which gives a node its
+ * distance in a global relabel is lost when another thread found the
+ * node first.
+ *
+ */
+
+struct contention_t {
+	long		adds;	/* atomic adds to e and h.	*/
+	long		timed;	/* of them timed.		*/
+	double		add;	/* seconds in the timed adds.	*/
+	long		swaps;	/* compare and swaps on dist.	*/
+	long		lost;	/* of them which failed.	*/
+};
+
+/* the sampled adds to one node, from all threads. */
+
+struct hot_t {
+	_Atomic long	samples;
+	_Atomic long	wait;	/* nanoseconds.			*/
+};
+
 struct edge_t {
 	node_t*		u;	/* one of the two nodes.	*/
 	node_t*		v;	/* the other. 			*/
@@ -88,6 +138,14 @@ struct graph_t {
 	edge_t*		e;	/* array of m edges.		*/
 	node_t*		s;	/* source.			*/
 	node_t*		t;	/* sink.			*/
+	pthread_barrier_t barrier;	/* between global relabel levels. */
+	_Atomic int*	dist;	/* distance to t in global relabel. */
+	_Atomic int	found;	/* nodes with a distance.	*/
+	int		global;	/* do a global relabel this round. */
+	double		bfs;	/* seconds in global relabel.	*/
+	hot_t*		hot;	/* n nodes with -DCONTENTION=1.	*/
+	long		maxscan;	/* sum of the largest scanned per round. */
+	long		sumscan;	/* sum of all scanned per round. */
 };
 
 struct worker_t {
@@ -95,6 +153,17 @@ struct worker_t {
 	graph_t*	g;
 	node_t*     next_round;
 	node_t*		excess;	/* nodes with e > 0 except s,t.	*/
+	long		relabels;
+	node_t**	cur;	/* frontier we found last level. */
+	int		ncur;
+	int		maxcur;
+	node_t**	next;	/* frontier we find this level. */
+	int		nnext;
+	int		maxnext;
+	long		load;	/* degrees given to us this round. */
+	long		scanned;	/* arcs scanned this round.	*/
+	long		total;	/* arcs scanned in all rounds.	*/
+	contention_t	contention;
 };
 
 pthread_cond_t cond_main = PTHREAD_COND_INITIALIZER;
@@ -148,6 +217,246 @@ static int next_int()
         return x;
 }
 
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+/* a global relabel is done after the first round and then whenever
+ * there have been global * n relabels since the last one. 0 turns it
+ * off.
+ *
+ */
+
+static int		global = GLOBAL;
+
+static int parse_global(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 0 || n > 1 << 24)
+		error("bad global relabel frequency \"%s\"", s);
+
+	return n;
+}
+
+/* active nodes are given to workers round robin or, by default, to
+ * the worker with the fewest arcs to scan so far in the round.
+ *
+ */
+
+enum { BALANCE_RR, BALANCE_DEGREE };
+
+static int		balance = BALANCE_DEGREE;
+
+static int parse_balance(const char* s)
+{
+	if (strcmp(s, "rr") == 0)
+		return BALANCE_RR;
+	else if (strcmp(s, "degree") == 0)
+		return BALANCE_DEGREE;
+
+	error("bad balance \"%s\": use rr or degree", s);
+
+	return BALANCE_DEGREE;
+}
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+
+	s = getenv("PREFLOW_GLOBAL");
+	if (s != NULL)
+		global = parse_global(s);
+
+	s = getenv("PREFLOW_BALANCE");
+	if (s != NULL)
+		balance = parse_balance(s);
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+#ifdef MAIN
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:g:b:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'b':
+			balance = parse_balance(optarg);
+			break;
+
+		case 'g':
+			global = parse_global(optarg);
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-g global] [-b rr|degree] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+#endif
+
 static void* xmalloc(size_t s)
 {
 	void*		p;
@@ -172,6 +481,16 @@ static void* xcalloc(size_t n, size_t s)
 	return p;
 }
 
+static void* xrealloc(void* p, size_t s)
+{
+	p = realloc(p, s);
+
+	if (p == NULL)
+		error("out of memory: realloc(%zu) failed", s);
+
+	return p;
+}
+
 static void mutex_lock(pthread_mutex_t* m, const char* name)
 {
 	/* lock a mutex and check that it was successful.
@@ -199,6 +518,7 @@ static void add_edge(node_t* u, edge_t* e)
 	p->edge = e;
 	p->next = u->edge;
 	u->edge = p;
+	u->degree += 1;
 }
 
 static void connect(node_t* u, node_t* v, int c, edge_t* e)
@@ -231,18 +551,144 @@ static node_t* other(node_t* u, edge_t* e)
 		return e->u;
 }
 
-static int getNextThreadIndex(graph_t* g)
+static int getNextThreadIndex(graph_t* g, node_t* u)
 {
 	int index = g->totalJobs % g->nthreads;
 	g->totalJobs += 1;
+
+	/* a worker is as late as the arcs it must scan, so give u to
+	 * the one with the fewest so far this round. ties go round robin.
+	 *
+	 */
+
+	if (balance == BALANCE_DEGREE) {
+		for (int i = 0; i < g->nthreads; i += 1)
+			if (g->worker[i].load < g->worker[index].load)
+				index = i;
+
+		g->worker[index].load += u->degree + 1;
+	}
+
 	return index;
 }
 
+static void account_round(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	long		sum;
+	int		i;
+
+	/* all workers wait so their counts for the round are final. */
+
+	max = 0;
+	sum = 0;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		w->total += w->scanned;
+		sum += w->scanned;
+		if (w->scanned > max)
+			max = w->scanned;
+		w->scanned = 0;
+		w->load = 0;
+	}
+
+	g->maxscan += max;
+	g->sumscan += sum;
+}
+
+#if PRINT || defined(TRACE)
+static void report_work(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	int		i;
+	int		k;
+
+	/* a histogram of the arcs each worker scanned, and how much
+	 * longer the rounds took than with a perfect balance, which is
+	 * the largest work of each round summed, against the mean.
+	 *
+	 */
+
+	max = 1;
+	for (i = 0; i < g->nthreads; i += 1)
+		if (g->worker[i].total > max)
+			max = g->worker[i].total;
+
+	fprintf(stderr, "arcs scanned per worker, %s assignment:\n",
+		balance == BALANCE_DEGREE ? "degree" : "round robin");
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		fprintf(stderr, "%4d %10ld ", i, w->total);
+		for (k = 0; k < 50 * w->total / max; k += 1)
+			fputc('#', stderr);
+		fputc('\n', stderr);
+	}
+
+	fprintf(stderr, "round imbalance (largest / mean): %.2f\n",
+		g->sumscan == 0 ? 1.0 : (double) g->nthreads * g->maxscan / g->sumscan);
+}
+#endif
+
+#if CONTENTION
+static int hotter(const void* a, const void* b)
+{
+	const hot_t*	x = *(const hot_t**) a;
+	const hot_t*	y = *(const hot_t**) b;
+
+	return x->wait < y->wait ? 1 : x->wait > y->wait ? -1 : 0;
+}
+
+static void report_contention(graph_t* g)
+{
+	contention_t*	c;
+	hot_t**		hot;
+	int		nhot;
+	int		i;
+	int		k;
+
+	/* the atomics of each worker, and then the nodes with the longest
+	 * sampled adds, which are the ones to keep within one worker.
+	 *
+	 */
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		c = &g->worker[i].contention;
+		fprintf(stderr, "contention worker %d: %ld adds, %ld timed in %.3f ms, "
+			"%ld swaps, %ld lost\n", i, c->adds, c->timed, c->add * 1e3,
+			c->swaps, c->lost);
+	}
+
+	hot = xmalloc(g->n * sizeof(hot_t*));
+	nhot = 0;
+
+	for (i = 0; i < g->n; i += 1)
+		if (g->hot[i].samples > 0)
+			hot[nhot++] = &g->hot[i];
+
+	qsort(hot, nhot, sizeof hot[0], hotter);
+
+	fprintf(stderr, "contention top %d of %d nodes, 1 in %d adds timed:\n",
+		MIN(TOP, nhot), nhot, SAMPLE);
+
+	for (k = 0; k < TOP && k < nhot; k += 1) {
+		i = hot[k] - g->hot;
+		fprintf(stderr, "contention node %d: degree %d, %ld samples, %.3f ms\n",
+			i, g->v[i].degree, (long) hot[k]->samples, hot[k]->wait * 1e-6);
+	}
+
+	free(hot);
+}
+#endif
+
 static void allocateNodeToThread(graph_t* g, node_t* u)
 {
 	if (u != g->s && u != g->t && u->in_queue == 0) {
 		u->in_queue = 1;
-		int index = getNextThreadIndex(g);
+		int index = getNextThreadIndex(g, u);
 		worker_t* worker = &g->worker[index];
 		u->next = worker->excess;
 		worker->excess = u;
@@ -252,6 +698,201 @@ static void allocateNodeToThread(graph_t* g, node_t* u)
 	}
 }
 
+static void bfs_add(worker_t* worker, node_t* u)
+{
+	if (worker->nnext == worker->maxnext) {
+		worker->maxnext = worker->maxnext == 0 ? 64 : 2 * worker->maxnext;
+		worker->next = xrealloc(worker->next, worker->maxnext * sizeof(node_t*));
+	}
+
+	worker->next[worker->nnext++] = u;
+}
+
+static void swap_frontier(worker_t* worker)
+{
+	node_t**	p;
+	int		max;
+
+	p = worker->cur;
+	max = worker->maxcur;
+
+	worker->cur = worker->next;
+	worker->ncur = worker->nnext;
+	worker->maxcur = worker->maxnext;
+
+	worker->next = p;
+	worker->nnext = 0;
+	worker->maxnext = max;
+}
+
+static void add_atomic(worker_t* worker, node_t* u, atomic_int* p, int x)
+{
+#if CONTENTION
+	contention_t*	c = &worker->contention;
+	hot_t*		hot;
+	double		begin;
+	double		wait;
+
+	c->adds += 1;
+
+	if (c->adds % SAMPLE == 0) {
+		begin = timebase_sec();
+		atomic_fetch_add_explicit(p, x, memory_order_relaxed);
+		wait = timebase_sec() - begin;
+
+		c->timed += 1;
+		c->add += wait;
+
+		hot = &worker->g->hot[id(worker->g, u)];
+		atomic_fetch_add_explicit(&hot->samples, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&hot->wait, (long) (wait * 1e9), memory_order_relaxed);
+		return;
+	}
+#else
+	(void) worker;
+	(void) u;
+#endif
+
+	atomic_fetch_add_explicit(p, x, memory_order_relaxed);
+}
+
+static void scan(worker_t* worker, node_t* u, int d)
+{
+	graph_t*	g = worker->g;
+	node_t*		v;
+	edge_t*		e;
+	list_t*		p;
+	int		expected;
+
+	/* find the nodes which can push to u and are not yet found.
+	 * in dense graphs all are found long before every arc has been
+	 * looked at, so stop then.
+	 *
+	 */
+
+	for (p = u->edge; p != NULL; p = p->next) {
+		if (atomic_load_explicit(&g->found, memory_order_relaxed) == g->n - 1)
+			return;
+
+		e = p->edge;
+
+		if (u == e->u) {
+			v = e->v;
+			if (-e->f == e->c)
+				continue;
+		} else {
+			v = e->u;
+			if (e->f == e->c)
+				continue;
+		}
+
+		if (v == g->s)
+			continue;
+
+		/* most nodes are already found, so look before the cas. */
+
+		if (atomic_load_explicit(&g->dist[id(g, v)], memory_order_relaxed) >= 0)
+			continue;
+
+		expected = -1;
+		if (atomic_compare_exchange_strong(&g->dist[id(g, v)], &expected, d)) {
+			atomic_fetch_add_explicit(&g->found, 1, memory_order_relaxed);
+			bfs_add(worker, v);
+		}
+#if CONTENTION
+		else
+			worker->contention.lost += 1;
+
+		worker->contention.swaps += 1;
+#endif
+	}
+}
+
+static void global_relabel(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+	worker_t*	w;
+	node_t*		u;
+	int		nthreads = g->nthreads;
+	int		level;
+	int		total;
+	int		begin;
+	int		end;
+	int		chunk;
+	int		i;
+	int		j;
+	int		k;
+	int		d;
+
+	/* set every height to the distance to the sink in the residual
+	 * graph with a backward breadth first search. each level is
+	 * scanned by all workers, each taking its share of what all
+	 * workers found in the level before, and new nodes go into the
+	 * next frontier of the worker that found them.
+	 *
+	 */
+
+	if (worker->i == 0) {
+		g->found = 1;
+		g->dist[id(g, g->t)] = 0;
+		bfs_add(worker, g->t);
+	}
+
+	for (level = 0; ; level += 1) {
+		swap_frontier(worker);
+		pthread_barrier_wait(&g->barrier);
+
+		total = 0;
+		for (j = 0; j < nthreads; j += 1)
+			total += g->worker[j].ncur;
+
+		if (total == 0)
+			break;
+
+		begin = (long) worker->i * total / nthreads;
+		end = (long) (worker->i + 1) * total / nthreads;
+
+		k = 0;
+		for (j = 0; j < nthreads && k < end; j += 1) {
+			w = &g->worker[j];
+			for (i = 0; i < w->ncur && k < end; i += 1, k += 1)
+				if (k >= begin)
+					scan(worker, w->cur[i], level + 1);
+		}
+
+		/* nobody swaps its frontier until all have read it. */
+
+		pthread_barrier_wait(&g->barrier);
+	}
+
+	/* nodes which cannot reach the sink must send their excess back
+	 * to the source and get at least its height. heights are never
+	 * lowered since they are lower bounds of the distance.
+	 *
+	 */
+
+	chunk = (g->n + nthreads - 1) / nthreads;
+	begin = MIN(worker->i * chunk, g->n);
+	end = MIN(begin + chunk, g->n);
+
+	for (i = begin; i < end; i += 1) {
+		u = &g->v[i];
+		d = g->dist[i];
+		g->dist[i] = -1;
+
+		if (u == g->s || u == g->t)
+			continue;
+
+		if (d < 0)
+			d = g->n;
+
+		if (d > atomic_load(&u->h))
+			atomic_store(&u->h, d);
+	}
+
+	pthread_barrier_wait(&g->barrier);
+}
+
 static void *work(void* args)
 {	
 	/* loop until only s and/or t have excess preflow. */
@@ -264,6 +905,9 @@ static void *work(void* args)
 	int 	df;
 	int 	u_e; 
 	int 	u_h;
+	int		relabel_all;
+	struct timespec	begin;
+	struct timespec	end;
 
 
 	while (1) {
@@ -279,6 +923,7 @@ static void *work(void* args)
 			while (p != NULL && u_e > 0) {
 				e = p->edge;
 				p = p->next;
+				worker->scanned += 1;
 
 				if (u == e->u) {
 					v = e->v;
@@ -294,7 +939,8 @@ static void *work(void* args)
 					//do reabel
 					//pr("create relabel work for node @%d\n", id(g, u));
 					// create relabel work
-					atomic_fetch_add_explicit(&u->h, 1 , memory_order_relaxed);
+					add_atomic(worker, u, &u->h, 1);
+					worker->relabels += 1;
 					pushed = 1;
 					break;
 				}
@@ -308,8 +954,8 @@ static void *work(void* args)
 					}
 					u_e -= abs(df);
 					// push atomically
-					atomic_fetch_add_explicit(&v->e, abs(df), memory_order_relaxed);
-					atomic_fetch_add_explicit(&u->e, -abs(df), memory_order_relaxed);
+					add_atomic(worker, v, &v->e, abs(df));
+					add_atomic(worker, u, &u->e, -abs(df));
 
 					// Create push work
 					// atomic_fetch_add_explicit(&delta_excess[id(g, v)], abs(df), memory_order_relaxed);
@@ -328,8 +974,10 @@ static void *work(void* args)
 
 
 			if (u_e> 0){
-				if (!pushed)
-					atomic_fetch_add_explicit(&u->h, 1 , memory_order_relaxed);
+				if (!pushed) {
+					add_atomic(worker, u, &u->h, 1);
+					worker->relabels += 1;
+				}
 				if (!atomic_flag_test_and_set(&u->has_delta_e)){
 					u->next_delta_e = worker->next_round;
 					worker->next_round = u;
@@ -363,7 +1011,22 @@ static void *work(void* args)
 			return 0;
 		}
 
+		relabel_all = g->global;
+
 		pthread_mutex_unlock(&mutex);
+
+		if (relabel_all) {
+			if (worker->i == 0)
+				clock_gettime(CLOCK_MONOTONIC, &begin);
+
+			global_relabel(worker);
+
+			if (worker->i == 0) {
+				clock_gettime(CLOCK_MONOTONIC, &end);
+				g->bfs += end.tv_sec - begin.tv_sec
+					+ (end.tv_nsec - begin.tv_nsec) * 1e-9;
+			}
+		}
 	}
 }
 
@@ -377,12 +1040,17 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 	list_t*		lp;
 	
 	graph_t*	g;
+	int		round;
+	int		nglobal;
+	long		relabels;
+	long		last;
 
 	allDone = 0;
 	waitingWorkers = 0;
 
 
-	int nthreads = 30;
+	read_options();
+	int nthreads = default_threads();
 	g = new_graph(n, m, s, t, e, nthreads);
 	
 	ns = g->s;
@@ -396,6 +1064,7 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 	lp = ns->edge;
 
 	pthread_t thread[nthreads];
+	pthread_attr_t	attr;
 
 	int totalPushed = 0;
 	int first = 1;
@@ -423,19 +1092,40 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 
 
 	ns->e -= totalPushed;
+
+	g->dist = xmalloc(n * sizeof(int));
+	for (int i = 0; i < n; i += 1)
+		g->dist[i] = -1;
+
+	g->hot = CONTENTION ? xcalloc(n, sizeof(hot_t)) : NULL;
+
+	g->global = 0;
+	g->bfs = 0;
+	nglobal = 0;
+	last = 0;
+
+	pthread_barrier_init(&g->barrier, NULL, nthreads);
 	
 	// Start working threads
 	for (int i = 0; i < nthreads; i += 1) {
-		if (pthread_create(&thread[i], NULL, work, (void *) &g->worker[i])) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
 			error("pthread_create failed");
 		}
+		pthread_attr_destroy(&attr);
 	}
 
-	while(1) {
+	for (round = 1; ; round += 1) {
         pthread_mutex_lock(&mutex);
 		while (waitingWorkers < nthreads) {
 			pthread_cond_wait(&cond_main, &mutex);
 		}
+
+		account_round(g);
+
+		relabels = 0;
+		for (int i = 0; i < nthreads; i += 1)
+			relabels += g->worker[i].relabels;
 		
 		if (-ns->e == nt->e) {
 			allDone = 1;
@@ -455,6 +1145,19 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 			g->worker[i].next_round = NULL;
 		}
 
+		/* the workers do a global relabel before the next round
+		 * after the first one and then when heights have been
+		 * lifted one step at a time often enough.
+		 *
+		 */
+
+		g->global = global > 0 && (round == 1
+			|| relabels - last >= (long) global * g->n);
+
+		if (g->global) {
+			last = relabels;
+			nglobal += 1;
+		}
 
 		waitingWorkers = 0;
 		pthread_cond_broadcast(&cond_worker);
@@ -468,7 +1171,27 @@ int preflow(int n, int m, int s, int t, xedge_t* e)
 			error("pthread_join failed");
 		}
 	}
+
+	pthread_barrier_destroy(&g->barrier);
+
+	pr("rounds: %d, relabels: %ld, global relabels: %d in %.3f ms\n",
+		round, relabels, nglobal, g->bfs * 1e3);
+
+#if CONTENTION
+	report_contention(g);
+#endif
+
+	free(g->hot);
+	free(g->dist);
+	for (int i = 0; i < nthreads; i += 1) {
+		free(g->worker[i].cur);
+		free(g->worker[i].next);
+	}
 	
+#if PRINT || defined(TRACE)
+	report_work(g);
+#endif
+
 	return nt->e;
 }
 
@@ -514,6 +1237,8 @@ static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
 
 	g->totalJobs = 0;
 	g->nthreads = nthreads;
+	g->maxscan = 0;
+	g->sumscan = 0;
 
 	g->worker = xcalloc(nthreads, sizeof(worker_t));
 	for (int i = 0; i < nthreads; i += 1) {
@@ -579,7 +1304,7 @@ int main(int argc, char* argv[])
 	next_int();
 	next_int();
 
-	int nthreads = 2;
+	int nthreads = options(argc, argv);
 
 	g = new_graph(in, n, m, nthreads);
 
@@ -614,6 +1339,8 @@ static graph_t* new_graph(int n, int m, int s, int t, xedge_t* e, int nthreads)
 
 	g->totalJobs = 0;
 	g->nthreads = nthreads;
+	g->maxscan = 0;
+	g->sumscan = 0;
 
 	g->worker = xcalloc(nthreads, sizeof(worker_t));
 	for (int i = 0; i < nthreads; i += 1) {
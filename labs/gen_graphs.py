@@ -0,0 +1,273 @@
+import argparse
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Write synthetic flow networks in the input format of the labs, "n m 0
+# 0" and then one "a b c" line per edge, with the source 0 and the sink
+# n-1. The edges are undirected as everywhere in the labs, so a family
+# made for directed graphs is only as hard as it is without directions.
+# The families are
+#
+#   random      m = n * degree edges between uniformly random nodes.
+#   grid        a road-like grid of about n nodes where each node has an
+#               edge to its right and lower neighbours, with the source
+#               on the left side and the sink on the right.
+#   rmat        a power-law graph of 2^k >= n nodes from the recursive
+#               matrix (R-MAT) model with a=0.57, b=c=0.19, d=0.05 and
+#               the source and sink joined to a few random nodes.
+#   ak          after Cherkassky and Goldberg's AK: a path whose nodes
+#               each leak one unit to the sink and whose capacities
+#               shrink along it, next to a path which carries one unit
+#               all the way, so that heights are raised one at a time.
+#   washington  a random level graph as made by the Washington
+#               generator: levels of nodes where each node has degree
+#               edges to random nodes in the next level, the source
+#               feeding the first level and the last level the sink.
+#
+# With --ans the answer is found with the sequential solver in lab0 and
+# written next to the input as the .ans files in data. With --suite a
+# few sizes of every family are written to a directory, by default
+# data/gen which bench.py also runs. lab0 has no global relabel, so an
+# answer for a grid of 100000 nodes takes several minutes.
+#
+# usage: python3 gen_graphs.py family [-n nodes] [-d degree] [-c capacity]
+#                              [-s seed] [-o file.in] [--ans]
+#        python3 gen_graphs.py --suite [--dir dir] [--sizes n,...] [--seeds s,...]
+#
+# e.g. python3 gen_graphs.py rmat -n 100000 -s 2 -o rmat.in --ans
+
+labs = os.path.dirname(os.path.abspath(__file__))
+
+flow_line = re.compile(r"^f = (-?\d+)$", re.MULTILINE)
+
+
+def random_graph(rng, n, degree, cap):
+    edges = []
+    for _ in range(n * degree):
+        a = rng.randrange(n)
+        b = rng.randrange(n)
+        if a != b:
+            edges.append((a, b, rng.randint(1, cap)))
+    return n, edges
+
+
+def grid(rng, n, degree, cap):
+    # Node 0 is the source, then the grid row by row, then the sink
+    rows = max(1, int((n - 2) ** 0.5))
+    cols = max(1, (n - 2) // rows)
+    n = rows * cols + 2
+    sink = n - 1
+    edges = []
+
+    def node(r, c):
+        return 1 + r * cols + c
+
+    for r in range(rows):
+        edges.append((0, node(r, 0), cap * degree))
+        edges.append((node(r, cols - 1), sink, cap * degree))
+        for c in range(cols):
+            if c + 1 < cols:
+                edges.append((node(r, c), node(r, c + 1), rng.randint(1, cap)))
+            if r + 1 < rows:
+                edges.append((node(r, c), node(r + 1, c), rng.randint(1, cap)))
+    return n, edges
+
+
+def rmat(rng, n, degree, cap, terminals=16):
+    # The R-MAT nodes are 1..2^k and the sink 2^k + 1
+    k = max(1, (n - 2 - 1).bit_length())
+    size = 1 << k
+    n = size + 2
+    sink = n - 1
+    edges = []
+
+    for _ in range(size * degree):
+        a = 0
+        b = 0
+        for level in range(k):
+            p = rng.random()
+            if p < 0.57:
+                pass
+            elif p < 0.76:
+                b |= 1 << level
+            elif p < 0.95:
+                a |= 1 << level
+            else:
+                a |= 1 << level
+                b |= 1 << level
+        if a != b:
+            edges.append((1 + a, 1 + b, rng.randint(1, cap)))
+
+    for _ in range(terminals):
+        edges.append((0, 1 + rng.randrange(size), cap * degree))
+        edges.append((1 + rng.randrange(size), sink, cap * degree))
+    return n, edges
+
+
+def ak(rng, n, degree, cap):
+    # Two paths of k nodes each: the first is 1..k and the second k+1..2k
+    k = max(2, (n - 2) // 2)
+    n = 2 * k + 2
+    sink = n - 1
+    edges = []
+
+    edges.append((0, 1, k))
+    for i in range(1, k):
+        edges.append((i, i + 1, k - i))
+    for i in range(1, k + 1):
+        edges.append((i, sink, 1))
+
+    edges.append((0, k + 1, 1))
+    for i in range(k + 1, 2 * k):
+        edges.append((i, i + 1, 1))
+    edges.append((2 * k, sink, 1))
+    return n, edges
+
+
+def washington(rng, n, degree, cap):
+    # Levels of width nodes, numbered level by level after the source
+    width = max(1, int((n - 2) ** 0.5))
+    levels = max(1, (n - 2) // width)
+    n = levels * width + 2
+    sink = n - 1
+    edges = []
+
+    def node(l, i):
+        return 1 + l * width + i
+
+    for i in range(width):
+        edges.append((0, node(0, i), cap * degree))
+        edges.append((node(levels - 1, i), sink, cap * degree))
+
+    for l in range(levels - 1):
+        for i in range(width):
+            for _ in range(degree):
+                edges.append((node(l, i), node(l + 1, rng.randrange(width)), rng.randint(1, cap)))
+    return n, edges
+
+
+families = {
+    "random": random_graph,
+    "grid": grid,
+    "rmat": rmat,
+    "ak": ak,
+    "washington": washington,
+}
+
+
+def generate(family, n, degree, cap, seed):
+    rng = random.Random(seed)
+    return families[family](rng, max(n, 4), degree, cap)
+
+
+def write(out, n, edges):
+    out.write("%d %d 0 0\n" % (n, len(edges)))
+    for a, b, c in edges:
+        out.write("%d %d %d\n" % (a, b, c))
+
+
+def build_solver(outdir):
+    exe = os.path.join(outdir, "sequential")
+    cmd = ["gcc", "-O3", "-I", os.path.join(labs, "common"), "-o", exe,
+           os.path.join(labs, "lab0/preflow.c"), os.path.join(labs, "common/timebase.c")]
+    subprocess.run(cmd, check=True)
+    return exe
+
+
+def answer(exe, path, timeout):
+    # Returns the flow from the sequential solver, or None if it failed
+    with open(path) as f:
+        try:
+            r = subprocess.run([exe], stdin=f, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                               timeout=timeout, text=True)
+        except subprocess.TimeoutExpired:
+            sys.stderr.write("gen_graphs: %s took over %g s, no answer\n" % (path, timeout))
+            return None
+    m = flow_line.search(r.stdout)
+    if r.returncode != 0 or m is None:
+        sys.stderr.write("gen_graphs: the solver failed on %s, no answer\n" % path)
+        return None
+    return int(m.group(1))
+
+
+def make(family, n, degree, cap, seed, path, exe, timeout):
+    n, edges = generate(family, n, degree, cap, seed)
+    with open(path, "w") as out:
+        write(out, n, edges)
+    line = "%-32s %8d nodes %9d edges" % (os.path.basename(path), n, len(edges))
+    if exe is not None:
+        f = answer(exe, path, timeout)
+        if f is not None:
+            with open(os.path.splitext(path)[0] + ".ans", "w") as out:
+                out.write("%d\n" % f)
+            line += "   f = %d" % f
+    print(line, flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="generate flow networks for the preflow engines")
+    parser.add_argument("family", nargs="?", choices=sorted(families),
+                        help="kind of graph")
+    parser.add_argument("-n", "--nodes", type=int, default=10000,
+                        help="about how many nodes (default %(default)s)")
+    parser.add_argument("-d", "--degree", type=int, default=4,
+                        help="edges per node where the family has a choice (default %(default)s)")
+    parser.add_argument("-c", "--capacity", type=int, default=100,
+                        help="largest random capacity (default %(default)s)")
+    parser.add_argument("-s", "--seed", type=int, default=1, help="random seed")
+    parser.add_argument("-o", "--output", help="file to write (default stdout)")
+    parser.add_argument("--ans", action="store_true",
+                        help="also write the answer from lab0 next to the output")
+    parser.add_argument("--suite", action="store_true",
+                        help="write every family in a few sizes with answers")
+    parser.add_argument("--dir", default=os.path.join(labs, "data", "gen"),
+                        help="directory for --suite (default data/gen)")
+    parser.add_argument("--sizes", default="1000,10000",
+                        help="node counts for --suite (default %(default)s)")
+    parser.add_argument("--seeds", default="1", help="seeds for --suite (default %(default)s)")
+    parser.add_argument("--timeout", type=float, default=600,
+                        help="seconds the solver may take per answer")
+    args = parser.parse_args()
+
+    if args.suite == (args.family is not None):
+        parser.error("give either a family or --suite")
+
+    if args.ans and args.output is None:
+        parser.error("--ans needs -o")
+
+    if not args.suite and not args.ans:
+        n, edges = generate(args.family, args.nodes, args.degree, args.capacity, args.seed)
+        if args.output is None:
+            write(sys.stdout, n, edges)
+        else:
+            with open(args.output, "w") as out:
+                write(out, n, edges)
+        return 0
+
+    outdir = tempfile.mkdtemp(prefix="gen")
+    try:
+        exe = build_solver(outdir)
+        if not args.suite:
+            make(args.family, args.nodes, args.degree, args.capacity, args.seed,
+                 args.output, exe, args.timeout)
+            return 0
+
+        os.makedirs(args.dir, exist_ok=True)
+        for family in sorted(families):
+            for n in [int(x) for x in args.sizes.split(",")]:
+                for seed in [int(x) for x in args.seeds.split(",")]:
+                    path = os.path.join(args.dir, "%s-%d-%d.in" % (family, n, seed))
+                    make(family, n, args.degree, args.capacity, seed, path, exe, args.timeout)
+    finally:
+        shutil.rmtree(outdir)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,279 @@
+import argparse
+import json
+import math
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tarfile
+import tempfile
+import time
+
+import bench
+
+# Run the engines of the labs and hi_pr, the push-relabel program of
+# Cherkassky and Goldberg in goldberg.tar, on the same graphs and report
+# how long each engine takes relative to hi_pr. This is the number we
+# want to bring down.
+#
+# hi_pr is built from the tarball in a temporary directory. It times
+# itself with getrusage in a float, which is only good to 10 ms, so the
+# copy there gets a timer from clock_gettime(CLOCK_MONOTONIC) and prints
+# its times with six decimals. Its parser reads "max" with %3s into a
+# char[3], which breaks with gcc -O3, so that array gets room for the
+# terminating null as well. Nothing else in it is changed. The inputs
+# are converted to DIMACS max-flow format, where each undirected edge of
+# the labs becomes an arc in each direction and nodes count from 1.
+# Self loops and nodes without edges are left out, since hi_pr reads
+# outside its arrays when a node has no arcs.
+#
+# hi_pr finds the flow value in its first stage and then turns the
+# preflow into a flow, which the engines of the labs never do, so it
+# is the time of the first stage ("c cut tm") which the solve phase of
+# the engines is compared with. The wall time of the whole process,
+# including reading the input, is compared as well. The flow from
+# every engine must be the one hi_pr found, and the .ans file if there
+# is one. At the end the geometric mean of the ratios of each engine
+# is printed.
+#
+# usage: python3 hipr.py [-e engine,...] [-d glob,...] [-t threads]
+#                        [-w warmup] [-n trials] [--timeout s]
+#                        [--perf] [--json file] [-- engine args]
+#
+# e.g. python3 hipr.py -e lab4 -d "big/*.in,gen/*.in" -t 4
+
+tarball = os.path.join(os.path.dirname(bench.labs), "goldberg.tar")
+
+hipr_timer = """#include <time.h>
+
+double timer ()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+"""
+
+# file, text, replacement and how many times the text is there
+patches = [
+    ("hi_pr.c", "float t, t2;", "double t, t2;", 1),
+    ("hi_pr.c", "%10.2f", "%10.6f", 2),
+    ("parser.c", "pr_type[3],", "pr_type[4],", 1),
+]
+
+flow_line = re.compile(r"^c flow:\s+(-?[0-9.]+)$", re.MULTILINE)
+stage_line = re.compile(r"^c cut tm:\s+([0-9.]+)$", re.MULTILINE)
+time_line = re.compile(r"^c time:\s+([0-9.]+)$", re.MULTILINE)
+
+
+def build_hipr(outdir):
+    with tarfile.open(tarball) as tar:
+        tar.extractall(outdir)
+    src = os.path.join(outdir, "goldberg")
+
+    with open(os.path.join(src, "timer.c"), "w") as f:
+        f.write(hipr_timer)
+
+    for name, old, new, count in patches:
+        path = os.path.join(src, name)
+        with open(path) as f:
+            s = f.read()
+        if s.count(old) != count:
+            sys.exit("hipr: %s in goldberg.tar is not the one expected" % name)
+        with open(path, "w") as f:
+            f.write(s.replace(old, new))
+
+    # The flags of its makefile, except that the solution is not checked
+    exe = os.path.join(outdir, "hi_pr")
+    cmd = ["gcc", "-O3", "-DNDEBUG", "-DEXCESS_TYPE_LONG", "-o", exe, "hi_pr.c"]
+    subprocess.run(cmd, check=True, cwd=src)
+    return exe
+
+
+def to_dimacs(path, out):
+    # Returns how many self loops and nodes without edges were left out
+    with open(path) as f:
+        words = f.read().split()
+    n = int(words[0])
+    m = int(words[1])
+    edges = []
+    loops = 0
+    for i in range(m):
+        u, v, c = words[4 + 3 * i: 7 + 3 * i]
+        if u == v:
+            loops += 1
+        else:
+            edges.append((int(u), int(v), c))
+
+    # hi_pr reads past its arcs if a node other than the sink has none,
+    # so the nodes with edges are numbered from 2 and the sink is last
+    number = [0] * n
+    for u, v, c in edges:
+        number[u] = number[v] = 1
+    k = 1
+    for u in range(1, n - 1):
+        if number[u]:
+            k += 1
+            number[u] = k
+    number[0] = 1
+    number[n - 1] = k + 1
+
+    with open(out, "w") as f:
+        f.write("p max %d %d\nn 1 s\nn %d t\n" % (k + 1, 2 * len(edges), k + 1))
+        for u, v, c in edges:
+            f.write("a %d %d %s\na %d %d %s\n" % (number[u], number[v], c, number[v], number[u], c))
+    return loops, n - k - 1
+
+
+def run_hipr(exe, path, args):
+    # Returns the flow and the times in ms of the trials, or an error
+    times = {"wall": [], "solve": [], "total": []}
+    flow = None
+    for i in range(args.warmup + args.trials):
+        with open(path) as f:
+            begin = time.perf_counter()
+            try:
+                r = subprocess.run([exe], stdin=f, stdout=subprocess.PIPE,
+                                   stderr=subprocess.PIPE, timeout=args.timeout, text=True)
+            except subprocess.TimeoutExpired:
+                return None, None, "timeout"
+            wall = (time.perf_counter() - begin) * 1e3
+
+        m = flow_line.search(r.stdout)
+        if r.returncode != 0 or m is None:
+            return None, None, "exit %d" % r.returncode
+
+        flow = int(float(m.group(1)))
+        if i >= args.warmup:
+            times["wall"].append(wall)
+            times["solve"].append(float(stage_line.search(r.stdout).group(1)) * 1e3)
+            times["total"].append(float(time_line.search(r.stdout).group(1)) * 1e3)
+
+    return flow, {p: bench.summary(xs) for p, xs in times.items()}, None
+
+
+def ratio(ours, theirs, phase):
+    # Our median over theirs, or None if either is missing or zero
+    if phase not in ours or phase not in theirs or theirs[phase]["median"] <= 0:
+        return None
+    return ours[phase]["median"] / theirs[phase]["median"]
+
+
+def geomean(xs):
+    xs = [x for x in xs if x is not None and x > 0]
+    if not xs:
+        return None
+    return math.exp(sum(math.log(x) for x in xs) / len(xs))
+
+
+def fmt(x):
+    return "-" if x is None else "%.2f" % x
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare the preflow engines with hi_pr")
+    parser.add_argument("-e", "--engines", default="lab4",
+                        help="comma separated engines (default %%(default)s, all: %s)"
+                        % ",".join(bench.engines))
+    parser.add_argument("-d", "--data", default="big/*.in,huge/*.in,skew/*.in,gen/*.in",
+                        help="comma separated globs under data (default %(default)s)")
+    parser.add_argument("-t", "--threads", type=int, default=None,
+                        help="PREFLOW_THREADS for the engines (default theirs)")
+    parser.add_argument("-w", "--warmup", type=int, default=1, help="untimed runs first")
+    parser.add_argument("-n", "--trials", type=int, default=5, help="timed runs")
+    parser.add_argument("--timeout", type=float, default=60, help="seconds per run")
+    parser.add_argument("--perf", action="store_true",
+                        help="set PREFLOW_PERF=1 and keep the perf counts of each kind of span")
+    parser.add_argument("--json", help="write the results as JSON to this file")
+    parser.add_argument("args", nargs="*", help="more arguments for every engine, after --")
+    args = parser.parse_args()
+
+    names = args.engines.split(",")
+    for name in names:
+        if name not in bench.engines:
+            parser.error("unknown engine %s: use %s" % (name, ",".join(bench.engines)))
+
+    paths = bench.inputs(args.data.split(","))
+    if not paths:
+        parser.error("no inputs match %s" % args.data)
+
+    outdir = tempfile.mkdtemp(prefix="hipr")
+    results = []
+    ratios = {name: {"solve": [], "wall": []} for name in names}
+
+    try:
+        hipr = build_hipr(outdir)
+        exes = {}
+        for name in names:
+            exe = bench.build(name, outdir, False)
+            if exe is not None:
+                exes[name] = exe
+
+        print("%-15s %-32s %-10s %12s %12s %8s %8s" % (
+            "engine", "input", "status", "solve ms", "hi_pr ms", "solve", "wall"))
+
+        for path in paths:
+            dimacs = os.path.join(outdir, "input.max")
+            loops, isolated = to_dimacs(path, dimacs)
+            flow, theirs, error = run_hipr(hipr, dimacs, args)
+            name = os.path.relpath(path, os.path.join(bench.labs, "data"))
+
+            if error is not None:
+                print("%-15s %-32s %-10s" % ("hi_pr", name, error), flush=True)
+                results.append({"engine": "hi_pr", "input": name, "status": error})
+                continue
+
+            results.append({"engine": "hi_pr", "input": name, "status": "ok", "flow": flow,
+                            "self_loops": loops, "isolated": isolated, "phases": theirs})
+
+            for engine, exe in exes.items():
+                r = bench.bench(engine, exe, path, args)
+                if r["status"] == "ok" and r["flow"] != flow:
+                    r["status"] = "wrong flow"
+
+                r["hi_pr"] = {p: ratio(r["phases"], theirs, p) for p in ("solve", "wall")}
+                results.append(r)
+
+                if r["status"] == "ok":
+                    for p, x in r["hi_pr"].items():
+                        ratios[engine][p].append(x)
+
+                ours = r["phases"].get("solve")
+                print("%-15s %-32s %-10s %12s %12.3f %8s %8s" % (
+                    engine, name, r["status"],
+                    "%.3f" % ours["median"] if ours is not None else "-",
+                    theirs["solve"]["median"],
+                    fmt(r["hi_pr"]["solve"]), fmt(r["hi_pr"]["wall"])), flush=True)
+    finally:
+        shutil.rmtree(outdir)
+
+    summary = {}
+    for engine in names:
+        summary[engine] = {p: geomean(xs) for p, xs in ratios[engine].items()}
+        print("%-15s geometric mean of time / hi_pr: solve %s, wall %s" % (
+            engine, fmt(summary[engine]["solve"]), fmt(summary[engine]["wall"])))
+
+    report = {
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "commit": bench.git_commit(),
+        "cpus": os.cpu_count(),
+        "threads": args.threads,
+        "warmup": args.warmup,
+        "trials": args.trials,
+        "summary": summary,
+        "results": results,
+    }
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+
+    failed = [r for r in results if r["status"] != "ok"]
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
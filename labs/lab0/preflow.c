@@ -33,6 +33,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "timebase.h"
 
 #define PRINT		0	/* enable/disable prints. */
 
@@ -317,18 +319,55 @@ static graph_t* new_graph(FILE* in, int n, int m)
 	g->t = &g->v[n-1];
 	g->excess = NULL;
 
-	for (i = 0; i < m; i += 1) {
-		a = next_int();
-		b = next_int();
-		c = next_int();
-		u = &g->v[a];
-		v = &g->v[b];
-		connect(u, v, c, g->e+i);
+	/* the edges are read first and then put in the adjacency lists,
+	 * so that -v can tell how long each takes.
+	 *
+	 */
+
+	PHASE("parse") {
+		for (i = 0; i < m; i += 1) {
+			a = next_int();
+			b = next_int();
+			c = next_int();
+			g->e[i].u = &g->v[a];
+			g->e[i].v = &g->v[b];
+			g->e[i].c = c;
+		}
+	}
+
+	PHASE("build") {
+		for (i = 0; i < m; i += 1) {
+			u = g->e[i].u;
+			v = g->e[i].v;
+			connect(u, v, g->e[i].c, g->e+i);
+		}
 	}
 
 	return g;
 }
 
+static void report_memory(graph_t* g)
+{
+	size_t		nodes;
+	size_t		edges;
+	size_t		lists;
+
+	/* what the graph takes with -v. every edge is in two adjacency
+	 * lists, and since each link is malloced by itself malloc uses
+	 * more than this for them, which shows in peak_rss.
+	 *
+	 */
+
+	nodes = g->n * sizeof(node_t);
+	edges = g->m * sizeof(edge_t);
+	lists = 2 * (size_t) g->m * sizeof(list_t);
+
+	memory_print("nodes", nodes, g->n, g->m);
+	memory_print("edges", edges, g->n, g->m);
+	memory_print("lists", lists, g->n, g->m);
+	memory_print("graph", sizeof(graph_t) + nodes + edges + lists, g->n, g->m);
+}
+
 static void enter_excess(graph_t* g, node_t* v)
 {
 	/* put v at the front of the list of nodes
@@ -524,9 +563,24 @@ int main(int argc, char* argv[])
 	int		f;	/* output from preflow.		*/
 	int		n;	/* number of nodes.		*/
 	int		m;	/* number of edges.		*/
+	int		opt;
 
 	progname = argv[0];	/* name is a string in argv[0]. */
 
+	/* -v prints how long each phase takes. */
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		if (opt == 'v')
+			phase_verbose = 1;
+		else
+			error("usage: %s [-v] < input", progname);
+	}
+
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
+
 	in = stdin;		/* same as System.in in Java.	*/
 
 	n = next_int();
@@ -540,11 +594,19 @@ int main(int argc, char* argv[])
 
 	fclose(in);
 
-	f = preflow(g);
+	report_memory(g);
+
+	PHASE("solve") {
+		f = preflow(g);
+	}
 
 	printf("f = %d\n", f);
 
-	free_graph(g);
+	memory_peak();
+
+	PHASE("teardown") {
+		free_graph(g);
+	}
 
 	return 0;
 }
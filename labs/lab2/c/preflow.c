@@ -27,6 +27,8 @@
  *
  */
  
+#define _GNU_SOURCE
+
 #include <alloca.h>
 #include <assert.h>
 #include <ctype.h>
@@ -37,6 +39,11 @@
 #include "timebase.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #define PRINT	0	/* enable/disable prints. */
 
@@ -56,6 +63,45 @@
 
 #define MIN(a,b)	(((a)<=(b))?(a):(b))
 
+/* the nodes are protected either by a pthread mutex in every node, as
+ * the lab started out, or by a small array of spinlocks where node i
+ * uses lock i % stripes. compile with -DLOCK=LOCK_MUTEX or
+ * -DLOCK=LOCK_TICKET to get the others.
+ *
+ */
+
+#define LOCK_MUTEX	0	/* a pthread_mutex_t in every node.	*/
+#define LOCK_TTAS	1	/* test and test-and-set spinlocks.	*/
+#define LOCK_TICKET	2	/* ticket spinlocks, taken in order.	*/
+
+#ifndef LOCK
+#define LOCK		LOCK_TTAS
+#endif
+
+#define STRIPES		4096	/* default number of spinlocks.	*/
+#define BACKOFF		1024	/* most pauses before yielding.	*/
+#define CACHE_LINE	64	/* bytes in a cache block.	*/
+
+/* with -DCONTENTION=1 every lock of a node which was not free at once
+ * is timed and counted per thread, and every SAMPLE:th such lock of a
+ * thread is also added to the node, so that the TOP nodes with the
+ * longest waits can be printed at the end as "contention ..." lines.
+ * a lock which is taken at once costs only a count.
+ *
+ */
+
+#ifndef CONTENTION
+#define CONTENTION	0
+#endif
+
+#ifndef SAMPLE
+#define SAMPLE		16	/* contended locks per sample.	*/
+#endif
+
+#ifndef TOP
+#define TOP		20	/* hottest nodes printed.	*/
+#endif
+
 /* introduce names for some structs. a struct is like a class, except
  * it cannot be extended and has no member methods, and everything is
  * public.
@@ -70,6 +116,9 @@ typedef struct node_t	node_t;
 typedef struct edge_t	edge_t;
 typedef struct list_t	list_t;
 typedef struct worker_t worker_t;
+typedef struct spinlock_t spinlock_t;
+typedef struct contention_t contention_t;
+typedef struct hot_t	hot_t;
 
 struct list_t {
 	edge_t*		edge;
@@ -82,7 +131,9 @@ struct node_t {
 	int			inQueue;/* is in someones excess list */
 	list_t*		edge;	/* adjacency list.		*/
 	node_t*		next;	/* with excess preflow.		*/
+#if LOCK == LOCK_MUTEX
 	pthread_mutex_t nodeLock;
+#endif
 };
 
 struct edge_t {
@@ -92,6 +143,32 @@ struct edge_t {
 	int			c;	/* capacity.			*/
 };
 
+struct spinlock_t {
+#if LOCK == LOCK_TICKET
+	_Atomic unsigned short	next;	/* ticket of the next to come.	*/
+	_Atomic unsigned short	owner;	/* ticket of the one inside.	*/
+#else
+	_Atomic int		locked;
+#endif
+};
+
+/* the waits of one thread, in a cache block of its own. */
+
+struct contention_t {
+	long		locks;		/* node locks taken.		*/
+	long		contended;	/* of them not free at once.	*/
+	long		retries;	/* failed tries while waiting.	*/
+	double		wait;		/* seconds waiting.		*/
+} __attribute__((aligned(CACHE_LINE)));
+
+/* the sampled waits for the lock of one node, from all threads. */
+
+struct hot_t {
+	_Atomic long	samples;	/* contended locks sampled.	*/
+	_Atomic long	retries;
+	_Atomic long	wait;		/* nanoseconds.			*/
+};
+
 struct graph_t {
 	int		n;	/* nodes.			*/
 	int		m;	/* edges.			*/
@@ -103,13 +180,20 @@ struct graph_t {
 	edge_t*		e;	/* array of m edges.		*/
 	node_t*		s;	/* source.			*/
 	node_t*		t;	/* sink.			*/
+	spinlock_t*	lock;	/* stripes spinlocks for the nodes. */
+	unsigned	mask;	/* stripes - 1.			*/
+	_Atomic int	active;	/* nodes in some excess list.	*/
+	contention_t	contention;	/* of the main thread.	*/
+	hot_t*		hot;	/* n nodes with -DCONTENTION=1.	*/
 };
 
 struct worker_t {
 	pthread_mutex_t excessMutex;
+	_Atomic int	parked;	/* 1 while waiting for work.	*/
 	int			i;
 	node_t*		excess;	/* nodes with e > 0 except s,t.	*/
 	graph_t*	g;		/* pointer to graph */
+	contention_t	contention;
 };
 
 /* a remark about C arrays. the phrase above 'array of n nodes' is using
@@ -137,6 +221,10 @@ struct worker_t {
 
 static char* progname;
 
+#if CONTENTION
+static __thread contention_t*	contention;	/* of this thread.	*/
+#endif
+
 static int id(graph_t* g, node_t* v)
 {
 	/* return the node index for v.
@@ -230,6 +318,219 @@ static int next_int()
         return x;
 }
 
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+/* the number of spinlocks is taken from -l or PREFLOW_STRIPES and is
+ * rounded up to a power of two. more stripes make it less likely that
+ * two workers want the same lock for different nodes.
+ *
+ */
+
+static int		stripes = STRIPES;
+
+static int parse_stripes(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > 1 << 24)
+		error("bad stripe count \"%s\"", s);
+
+	return n;
+}
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+
+	s = getenv("PREFLOW_STRIPES");
+	if (s != NULL)
+		stripes = parse_stripes(s);
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:l:v")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'l':
+			stripes = parse_stripes(optarg);
+			break;
+
+		case 'v':
+			phase_verbose = 1;
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-l stripes] [-v] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+
 static void* xmalloc(size_t s)
 {
 	void*		p;
@@ -293,6 +594,210 @@ static void mutex_lock(pthread_mutex_t* m, const char* name)
 
 }
 
+#if LOCK != LOCK_MUTEX
+static void pause_cpu(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+#if LOCK != LOCK_TICKET
+static void backoff(int* delay)
+{
+	int		i;
+
+	/* wait twice as long each time, but give the cpu away instead
+	 * when the waits get long, since whoever holds the lock may be
+	 * waiting for a cpu itself.
+	 *
+	 */
+
+	if (*delay > BACKOFF) {
+		sched_yield();
+		return;
+	}
+
+	for (i = 0; i < *delay; i += 1)
+		pause_cpu();
+
+	*delay *= 2;
+}
+#endif
+
+static int spin_lock(spinlock_t* l)
+{
+	int		delay = 1;
+	int		retries = 0;
+
+#if LOCK == LOCK_TICKET
+	unsigned short	me;
+	unsigned short	ahead;
+	int		i;
+
+	/* wait in proportion to how many are ahead of us, and yield
+	 * after a while as above. the lock is handed on in order, so a
+	 * waiter which is not running holds up everyone after it.
+	 *
+	 */
+
+	me = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+
+	while ((ahead = me - atomic_load_explicit(&l->owner, memory_order_acquire)) != 0) {
+		retries += 1;
+
+		if (delay > BACKOFF) {
+			sched_yield();
+			continue;
+		}
+
+		for (i = 0; i < 16 * ahead; i += 1)
+			pause_cpu();
+
+		delay += 16 * ahead;
+	}
+#else
+	/* only try to take the lock when it looks free, so that waiting
+	 * is done in our own cache.
+	 *
+	 */
+
+	while (atomic_exchange_explicit(&l->locked, 1, memory_order_acquire)) {
+		retries += 1;
+		do
+			backoff(&delay);
+		while (atomic_load_explicit(&l->locked, memory_order_relaxed));
+	}
+#endif
+
+	/* how many times it was found taken, which is only used with
+	 * -DCONTENTION=1.
+	 *
+	 */
+
+	return retries;
+}
+
+#if CONTENTION
+static int spin_trylock(spinlock_t* l)
+{
+#if LOCK == LOCK_TICKET
+	unsigned short	owner;
+
+	/* take the next ticket only if it is the one served now. */
+
+	owner = atomic_load_explicit(&l->owner, memory_order_relaxed);
+
+	return atomic_compare_exchange_strong_explicit(&l->next, &owner, owner + 1,
+		memory_order_acquire, memory_order_relaxed);
+#else
+	return !atomic_load_explicit(&l->locked, memory_order_relaxed)
+		&& !atomic_exchange_explicit(&l->locked, 1, memory_order_acquire);
+#endif
+}
+#endif
+
+static void spin_unlock(spinlock_t* l)
+{
+#if LOCK == LOCK_TICKET
+	atomic_store_explicit(&l->owner,
+		atomic_load_explicit(&l->owner, memory_order_relaxed) + 1,
+		memory_order_release);
+#else
+	atomic_store_explicit(&l->locked, 0, memory_order_release);
+#endif
+}
+#endif
+
+static unsigned lock_id(graph_t* g, node_t* u)
+{
+#if LOCK == LOCK_MUTEX
+	return id(g, u);
+#else
+	return id(g, u) & g->mask;
+#endif
+}
+
+#if CONTENTION
+static void contended(graph_t* g, node_t* u, int retries, double wait)
+{
+	contention_t*	c = contention;
+	hot_t*		hot;
+
+	c->contended += 1;
+	c->retries += retries;
+	c->wait += wait;
+
+	if (c->contended % SAMPLE != 0)
+		return;
+
+	hot = &g->hot[id(g, u)];
+	atomic_fetch_add_explicit(&hot->samples, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hot->retries, retries, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hot->wait, (long) (wait * 1e9), memory_order_relaxed);
+}
+#endif
+
+static void lock_node(graph_t* g, node_t* u)
+{
+#if CONTENTION
+	double		begin;
+	int		retries;
+
+	contention->locks += 1;
+
+#if LOCK == LOCK_MUTEX
+	if (pthread_mutex_trylock(&u->nodeLock) == 0)
+		return;
+
+	begin = timebase_sec();
+	pthread_mutex_lock(&u->nodeLock);
+	retries = 1;
+#else
+	if (spin_trylock(&g->lock[lock_id(g, u)]))
+		return;
+
+	begin = timebase_sec();
+	retries = 1 + spin_lock(&g->lock[lock_id(g, u)]);
+#endif
+
+	contended(g, u, retries, timebase_sec() - begin);
+#elif LOCK == LOCK_MUTEX
+	pthread_mutex_lock(&u->nodeLock);
+#else
+	spin_lock(&g->lock[lock_id(g, u)]);
+#endif
+}
+
+static void unlock_node(graph_t* g, node_t* u)
+{
+#if LOCK == LOCK_MUTEX
+	pthread_mutex_unlock(&u->nodeLock);
+#else
+	spin_unlock(&g->lock[lock_id(g, u)]);
+#endif
+}
+
+static void futex_wait(_Atomic int* p, int value)
+{
+	/* sleep unless *p has changed from value. */
+
+	syscall(SYS_futex, p, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic int* p)
+{
+	syscall(SYS_futex, p, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void unpark(worker_t* worker)
+{
+	if (atomic_exchange(&worker->parked, 0))
+		futex_wake(&worker->parked);
+}
+
 static void add_edge(node_t* u, edge_t* e)
 {
 	list_t*		p;
@@ -358,21 +863,94 @@ static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
 	
 	for (i = 0; i < n; i += 1) {
 		g->v[i].inQueue = 0;
+#if LOCK == LOCK_MUTEX
 		pthread_mutex_init(&g->v[i].nodeLock, NULL);
+#endif
+	}
+
+	g->lock = NULL;
+	g->mask = 0;
+	g->hot = NULL;
+
+#if CONTENTION
+	memset(&g->contention, 0, sizeof g->contention);
+	g->hot = xcalloc(n, sizeof(hot_t));
+#endif
+
+#if LOCK != LOCK_MUTEX
+	for (a = 1; a < stripes; a *= 2)
+		;
+
+	g->lock = xcalloc(a, sizeof(spinlock_t));
+	g->mask = a - 1;
+#endif
+
+	/* the edges are read first and then put in the adjacency lists,
+	 * so that -v can tell how long each takes.
+	 *
+	 */
+
+	PHASE("parse") {
+		for (i = 0; i < m; i += 1) {
+			a = next_int();
+			b = next_int();
+			c = next_int();
+			g->e[i].u = &g->v[a];
+			g->e[i].v = &g->v[b];
+			g->e[i].c = c;
+		}
 	}
 
-	for (i = 0; i < m; i += 1) {
-		a = next_int();
-		b = next_int();
-		c = next_int();
-		u = &g->v[a];
-		v = &g->v[b];
-		connect(u, v, c, &g->e[i]);
+	PHASE("build") {
+		for (i = 0; i < m; i += 1) {
+			u = g->e[i].u;
+			v = g->e[i].v;
+			connect(u, v, g->e[i].c, &g->e[i]);
+		}
 	}
 
 	return g;
 }
 
+static void report_memory(graph_t* g)
+{
+	size_t		nodes;
+	size_t		locks;
+	size_t		edges;
+	size_t		lists;
+	size_t		workers;
+	size_t		hot;
+
+	/* what the graph takes with -v. the locks are either a mutex in
+	 * every node, which is counted as locks and not as nodes, or the
+	 * stripes. every edge is in two adjacency lists, and since each
+	 * link is malloced by itself malloc uses more than this for them,
+	 * which shows in peak_rss.
+	 *
+	 */
+
+#if LOCK == LOCK_MUTEX
+	locks = g->n * sizeof(pthread_mutex_t);
+#else
+	locks = (g->mask + 1) * sizeof(spinlock_t);
+#endif
+	nodes = g->n * sizeof(node_t) - (LOCK == LOCK_MUTEX ? locks : 0);
+	edges = g->m * sizeof(edge_t);
+	lists = 2 * (size_t) g->m * sizeof(list_t);
+	workers = g->nthreads * sizeof(worker_t);
+	hot = g->hot != NULL ? g->n * sizeof(hot_t) : 0;
+
+	memory_print("nodes", nodes, g->n, g->m);
+	memory_print("locks", locks, g->n, g->m);
+	memory_print("edges", edges, g->n, g->m);
+	memory_print("lists", lists, g->n, g->m);
+	memory_print("workers", workers, g->n, g->m);
+	if (hot > 0)
+		memory_print("contention", hot, g->n, g->m);
+	memory_print("graph", sizeof(graph_t) + nodes + locks + edges + lists + workers + hot,
+		g->n, g->m);
+}
+
 static void push(graph_t* g, node_t* u, node_t* v, edge_t* e)
 {
 	int		d;	/* remaining capacity of the edge. */
@@ -400,9 +978,9 @@ static void push(graph_t* g, node_t* u, node_t* v, edge_t* e)
 
 static void relabel(graph_t* g, node_t* u)
 {
-	pthread_mutex_lock(&u->nodeLock);
+	lock_node(g, u);
 	u->h += 1;
-	pthread_mutex_unlock(&u->nodeLock);
+	unlock_node(g, u);
 	pr("relabel %d now h = %d\n", id(g, u), u->h);
 }
 
@@ -446,6 +1024,8 @@ void allocateWorkToThreads(graph_t* g, node_t* u, int index)
 			u->next = g->worker[index].excess;
 			g->worker[index].excess = u;
 			u->inQueue = 1;
+			atomic_fetch_add(&g->active, 1);
+			unpark(&g->worker[index]);
 			pr("allocated node u%d (should be %d) to thread @%d\n", id(g, g->worker[index].excess), id(g,u), index);
 		}		
 
@@ -457,29 +1037,39 @@ void allocateWorkToThreads(graph_t* g, node_t* u, int index)
 }
 
 void lockNodes(graph_t* g, node_t* u, node_t* v){
-	if (id(g,u) < id(g,v)) {
+	/* take the locks in the order of their ids so that no two
+	 * workers wait for each other. with stripes both nodes can
+	 * have the same lock, and then it is taken once.
+	 *
+	 */
+
+	if (lock_id(g, u) == lock_id(g, v)) {
+		lock_node(g, u);
+	} else if (lock_id(g, u) < lock_id(g, v)) {
 		// pr("Attempting to lock u%d and v%d\n", id(g, u), id(g, v));
-		pthread_mutex_lock(&u->nodeLock);
-		pthread_mutex_lock(&v->nodeLock);
+		lock_node(g, u);
+		lock_node(g, v);
 		// pr("Locked u%d and v%d\n", id(g, u), id(g, v));
 	} else {
 		// pr("Attempting to lock v%d and u%d\n", id(g, v), id(g, u));
-		pthread_mutex_lock(&v->nodeLock);
-		pthread_mutex_lock(&u->nodeLock);
+		lock_node(g, v);
+		lock_node(g, u);
 		// pr("Locked v%d and u%d\n", id(g, v), id(g, u));
 	}
 }
 
 void unlockNodes(graph_t* g, node_t* u, node_t* v){
-	if (id(g,u) < id(g,v)) {
+	if (lock_id(g, u) == lock_id(g, v)) {
+		unlock_node(g, u);
+	} else if (lock_id(g, u) < lock_id(g, v)) {
 		// pr("Unlocking u%d and v%d\n", id(g, u), id(g, v));
-		pthread_mutex_unlock(&v->nodeLock);
-		pthread_mutex_unlock(&u->nodeLock);
+		unlock_node(g, v);
+		unlock_node(g, u);
 		// pr("Unlocked u%d and v%d\n", id(g, u), id(g, v));
 	} else {
 		// pr("Unlocking v%d and u%d\n", id(g, v), id(g, u));
-		pthread_mutex_unlock(&u->nodeLock);
-		pthread_mutex_unlock(&v->nodeLock);
+		unlock_node(g, u);
+		unlock_node(g, v);
 		// pr("Unlocked v%d and u%d\n", id(g, v), id(g, u));
 	}
 }
@@ -503,26 +1093,37 @@ void *work(void* args)
 
 	int stuck = 0;
 
+#if CONTENTION
+	contention = &worker->contention;
+#endif
+
 	while (1) {
 		pthread_mutex_lock(&worker->excessMutex);
 		node_t * u = worker->excess;
 		if (worker->excess == NULL) {
+			/* every node with excess is in some list until it has
+			 * none, so when no node is in a list we are done. a
+			 * node can only be given to us while we hold no lock
+			 * and after parked is set, and then we are woken.
+			 *
+			 */
+
+			atomic_store(&worker->parked, 1);
 			pthread_mutex_unlock(&worker->excessMutex);
-			lockNodes(g, g->s, g->t);
-			//pr("s->e = %d, t->e = %d\n", g->s->e, g->t->e);
-			if (abs(g->s->e) == g->t->e){
-				unlockNodes(g, g->s, g->t);
+
+			if (atomic_load(&g->active) == 0) {
 				pr("killed thread @%d, s->e = %d, t->e = %d\n", worker->i, g->s->e, g->t->e);
 				return (void *) NULL;
-			} else {
-				unlockNodes(g, g->s, g->t);
-				if (!stuck) {
-					// printGraphState(g);
-					pr("@T%d: thread has no more jobs right now.\n", worker->i);
-					stuck = 1;
-				}
-				continue;
 			}
+
+			if (!stuck) {
+				// printGraphState(g);
+				pr("@T%d: thread has no more jobs right now.\n", worker->i);
+				stuck = 1;
+			}
+
+			futex_wait(&worker->parked, 1);
+			continue;
 		}
 		pthread_mutex_unlock(&worker->excessMutex);
 		if (stuck) {
@@ -584,15 +1185,27 @@ void *work(void* args)
 
 		pr("@T%d: locking nodeLock for n%d and excess lock.\n", worker->i, id(g,worker->excess));
 		pthread_mutex_lock(&worker->excessMutex);
-		pthread_mutex_lock(&worker->excess->nodeLock);
+		lock_node(g, worker->excess);
 		node_t * temp = worker->excess;
+		int last = 0;
 		if (worker->excess->e == 0) {
 			worker->excess = worker->excess->next;
 			temp->next = NULL; // possible data race here, prob need to lock temp (excess)
 			temp->inQueue = 0;
+			last = atomic_fetch_sub(&g->active, 1) == 1;
 		}
-		pthread_mutex_unlock(&temp->nodeLock);
+		unlock_node(g, temp);
 		pthread_mutex_unlock(&worker->excessMutex);
+
+		/* the last node without excess wakes everybody so that
+		 * they see that we are done.
+		 *
+		 */
+
+		if (last) {
+			for (int i = 0; i < g->nthreads; i += 1)
+				unpark(&g->worker[i]);
+		}
 		pr("@T%d: unlocked nodeLock for n%d and excess mutex\n.", worker->i, id(g, worker->excess));
 
 	}
@@ -618,6 +1231,7 @@ int preflow(graph_t* g)
 	 *
 	 */
 	pthread_t thread[nthreads];
+	pthread_attr_t	attr;
 
 	int totalPushed = 0;
 	while (p != NULL) {
@@ -641,16 +1255,18 @@ int preflow(graph_t* g)
 	}
 
 	// Establish initial source flow
-	pthread_mutex_lock(&s->nodeLock);
+	lock_node(g, s);
 	s->e -= totalPushed;
-	pthread_mutex_unlock(&s->nodeLock);
+	unlock_node(g, s);
 	pr("unlocked source, totalPushed from source initially: %d\n", s->e);
 	
 	// Start working threads
 	for (int i = 0; i < nthreads; i += 1) {
-		if (pthread_create(&thread[i], NULL, work, (void *) &g->worker[i])) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
 			error("pthread_create failed");
 		}
+		pthread_attr_destroy(&attr);
 	}
 
 	for (int i = 0; i< nthreads; i += 1) {
@@ -663,6 +1279,72 @@ int preflow(graph_t* g)
 	return g->t->e;
 }
 
+#if CONTENTION
+static int hotter(const void* a, const void* b)
+{
+	const hot_t*	x = *(const hot_t**) a;
+	const hot_t*	y = *(const hot_t**) b;
+
+	return x->wait < y->wait ? 1 : x->wait > y->wait ? -1 : 0;
+}
+
+static void print_contention(const char* name, contention_t* c)
+{
+	fprintf(stderr, "contention %s: %ld locks, %ld contended, %ld retries, %.3f ms\n",
+		name, c->locks, c->contended, c->retries, c->wait * 1e3);
+}
+
+static void report_contention(graph_t* g)
+{
+	hot_t**		hot;
+	char		name[32];
+	int		nhot;
+	int		degree;
+	list_t*		p;
+	int		i;
+	int		k;
+
+	/* the waits of each thread, and then the nodes with the longest
+	 * sampled waits, which are the ones to give a lock of their own
+	 * or to keep within one worker.
+	 *
+	 */
+
+	print_contention("main", &g->contention);
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		snprintf(name, sizeof name, "worker %d", i);
+		print_contention(name, &g->worker[i].contention);
+	}
+
+	hot = xmalloc(g->n * sizeof(hot_t*));
+	nhot = 0;
+
+	for (i = 0; i < g->n; i += 1)
+		if (g->hot[i].samples > 0)
+			hot[nhot++] = &g->hot[i];
+
+	qsort(hot, nhot, sizeof hot[0], hotter);
+
+	fprintf(stderr, "contention top %d of %d nodes, 1 in %d contended locks sampled:\n",
+		MIN(TOP, nhot), nhot, SAMPLE);
+
+	for (k = 0; k < TOP && k < nhot; k += 1) {
+		i = hot[k] - g->hot;
+
+		degree = 0;
+		for (p = g->v[i].edge; p != NULL; p = p->next)
+			degree += 1;
+
+		fprintf(stderr, "contention node %d: lock %u, degree %d, %ld samples, "
+			"%ld retries, %.3f ms\n", i, lock_id(g, &g->v[i]), degree,
+			(long) hot[k]->samples, (long) hot[k]->retries, hot[k]->wait * 1e-6);
+	}
+
+	free(hot);
+}
+#endif
+
 static void free_graph(graph_t* g)
 {
 	int		i;
@@ -674,9 +1356,13 @@ static void free_graph(graph_t* g)
 	for (int i = 0; i < g->nthreads; i++) {
 		pthread_mutex_destroy(&g->worker[i].excessMutex);
 	}
+#if LOCK == LOCK_MUTEX
 	for (int i = 0; i < g->n; i++) {
 		pthread_mutex_destroy(&g->v[i].nodeLock);
 	}
+#endif
+	free(g->lock);
+	free(g->hot);
 
 	for (i = 0; i < g->n; i += 1) {
 		p = g->v[i].edge;
@@ -711,11 +1397,11 @@ void *debug_thread(void *arg)
             node_t *node = &g->v[i];
 
             // Lock the node's mutex before accessing its data
-            pthread_mutex_lock(&node->nodeLock);
+            lock_node(g, node);
 
             pr("Node %d: h=%d, e=%d\n", i, node->h, node->e);
 
-            pthread_mutex_unlock(&node->nodeLock);
+            unlock_node(g, node);
         }
         printf("\n");
 
@@ -743,17 +1429,38 @@ int main(int argc, char* argv[])
 	next_int();
 	next_int();
 
-	int nthreads = 2;
+	int nthreads = options(argc, argv);
+
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
 
 	g = new_graph(in, n, m, nthreads);
 
 	fclose(in);
 
-	f = preflow(g);
+	report_memory(g);
+
+#if CONTENTION
+	contention = &g->contention;
+#endif
+
+	PHASE("solve") {
+		f = preflow(g);
+	}
 
 	printf("f = %d\n", f);
 
-	free_graph(g);
+#if CONTENTION
+	report_contention(g);
+#endif
+
+	memory_peak();
+
+	PHASE("teardown") {
+		free_graph(g);
+	}
 	
 
 	return 0;
@@ -1,2 +0,0 @@
-void init_timebase(void);
-double timebase_sec(void);
@@ -27,6 +27,8 @@
  *
  */
  
+#define _GNU_SOURCE
+
 #include <alloca.h>
 #include <bits/pthreadtypes.h>
 #include <ctype.h>
@@ -36,9 +38,19 @@
 #include <string.h>
 
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "timebase.h"
+#include "trace.h"
+#include "pthread_barrier.h"
 
 #define PRINT	0	/* enable/disable prints. */
 #define FORSETE
+#define CACHE_LINE	64	/* bytes in a cache block.	*/
+
+#ifndef STATS
+#define STATS	0	/* count operations, see stat_t.	*/
+#endif
 
 /* the funny do-while next clearly performs one iteration of the loop.
  * if you are really curious about why there is a loop, please check
@@ -54,8 +66,18 @@
 #define pr(...)		/* no effect at all */
 #endif
 
+#define TAIL	32	/* default active nodes for sequential tail. */
+
 #define MIN(a,b)	(((a)<=(b))?(a):(b))
 
+#if STATS
+#define stat_add(s, x, n)	((s)->x += (n))
+#define stat_time()		timebase_sec()
+#else
+#define stat_add(s, x, n)	((void) (n))
+#define stat_time()		0.0
+#endif
+
 /* introduce names for some structs. a struct is like a class, except
  * it cannot be extended and has no member methods, and everything is
  * public.
@@ -70,13 +92,10 @@ typedef struct node_t	node_t;
 typedef struct edge_t	edge_t;
 typedef struct list_t	list_t;
 typedef struct worker_t worker_t;
-typedef struct work_t work_t;
 typedef struct push_t push_t;
 typedef struct relabel_t relabel_t;
-typedef enum WORK_TYPE {
-	WORK_PUSH,
-	WORK_RELABEL
-} work_type;
+typedef struct buffer_t buffer_t;
+typedef struct stat_t stat_t;
 
 struct list_t {
 	edge_t*		edge;
@@ -89,6 +108,7 @@ struct node_t {
 	list_t*		edge;	/* adjacency list.		*/
 	node_t*		next;	/* with excess preflow.		*/
 	int 		in_queue;
+	int			degree;	/* arcs in adjacency list.	*/
 };
 
 struct edge_t {
@@ -98,40 +118,84 @@ struct edge_t {
 	int			c;	/* capacity.			*/
 };
 
+/* what one thread did, counted with -DSTATS=1 and printed as "stat
+ * NAME: X" lines at the end. each thread has its own in a cache block
+ * of its own so that the counting causes no false sharing, and they
+ * are added up when the threads are done.
+ *
+ */
+
+#if STATS
+struct stat_t {
+	long		pushes;
+	long		saturating;	/* pushes which filled the arc.	*/
+	long		relabels;
+	long		discharges;	/* active nodes discharged.	*/
+	long		scans;	/* arcs scanned by main.	*/
+	double		idle;	/* seconds waiting for others.	*/
+} __attribute__((aligned(CACHE_LINE)));
+#endif
+
 struct graph_t {
 	int		n;	/* nodes.			*/
 	int		m;	/* edges.			*/
 	int    	nthreads;
 	int     totalJobs;
+	int		chunk;	/* nodes in each range of target nodes. */
 	worker_t* 	worker;
 	node_t*		v;	/* array of n nodes.		*/
 	edge_t*		e;	/* array of m edges.		*/
 	node_t*		s;	/* source.			*/
 	node_t*		t;	/* sink.			*/
+	pthread_barrier_t barrier;	/* all work created before it is applied. */
+	long		maxscan;	/* sum of the largest scanned per round. */
+	long		sumscan;	/* sum of all scanned per round. */
+	size_t		maxwork;	/* most bytes of work in a round. */
+	int		maxround;	/* the round with maxwork.	*/
+#if STATS
+	stat_t		stat;	/* of the main thread.		*/
+#endif
+	trace_t*	trace;	/* of the main thread.		*/
+};
+
+/* the work created in a round is kept in contiguous arrays, one buffer
+ * for each range of g->chunk target nodes, instead of in a list with
+ * one malloc per operation. worker i later applies the buffers for
+ * range i from every worker, so no two threads touch the same node.
+ *
+ */
+
+struct buffer_t {
+	push_t*		push;
+	int			npush;
+	int			maxpush;
+	relabel_t*	relabel;
+	int			nrelabel;
+	int			maxrelabel;
 };
 
 struct worker_t {
 	int			i;
-	int			nbrJobs;
 	graph_t*	g;
 	node_t*		excess;	/* nodes with e > 0 except s,t.	*/
-	work_t*		work;
-};
-
-struct work_t {
-	work_type type;
-	union {
-		push_t* push;
-		relabel_t* relabel;
-	} task;
-	work_t* next;
+	buffer_t*	work;	/* nthreads buffers, one per range. */
+	node_t**	active;	/* nodes with e > 0 after the round. */
+	int			nactive;
+	int			maxactive;
+	long		load;	/* degrees given to us this round. */
+	long		scanned;	/* arcs scanned this round.	*/
+	long		total;	/* arcs scanned in all rounds.	*/
+	size_t		used;	/* bytes of work we applied.	*/
+#if STATS
+	stat_t		stat;
+#endif
+	trace_t*	trace;	/* NULL unless tracing.		*/
 };
 
 struct push_t {
-	node_t* u;
-	node_t* v;
+	node_t* v;	/* node receiving the flow.	*/
 	edge_t* e;
-	int d;
+	int d;		/* added to e->f.		*/
 };
 
 struct relabel_t {
@@ -146,45 +210,46 @@ int waitingWorkers = 0;
 int allDone = 0;
 
 static void* xmalloc(size_t s);
+static void* xrealloc(void* p, size_t s);
 
-void create_push_work(work_t** work_list, node_t* u, node_t* v, edge_t* e, int df) {
-	push_t* push_task = xmalloc(sizeof(push_t));
-	push_task->u = u;
+void create_push_work(buffer_t* b, node_t* v, edge_t* e, int df) {
+	if (b->npush == b->maxpush) {
+		b->maxpush = b->maxpush == 0 ? 64 : 2 * b->maxpush;
+		b->push = xrealloc(b->push, b->maxpush * sizeof(push_t));
+	}
+
+	push_t* push_task = &b->push[b->npush++];
 	push_task->v = v;
 	push_task->e = e;
 	push_task->d = df;
+}
 
-    work_t* work = xmalloc(sizeof(work_t));
-    work->type = WORK_PUSH;
-    work->task.push = push_task;
+void create_relabel_work(buffer_t* b, node_t* u) {
+	if (b->nrelabel == b->maxrelabel) {
+		b->maxrelabel = b->maxrelabel == 0 ? 64 : 2 * b->maxrelabel;
+		b->relabel = xrealloc(b->relabel, b->maxrelabel * sizeof(relabel_t));
+	}
 
-	work->next = *work_list;
-	*work_list = work;
+	b->relabel[b->nrelabel++].u = u;
 }
 
-void create_relabel_work(work_t** work_list, node_t* u) {
-	relabel_t* relabel_task = xmalloc(sizeof(relabel_t));
-	relabel_task->u = u;
+void add_active(worker_t* worker, node_t* u) {
+	if (worker->nactive == worker->maxactive) {
+		worker->maxactive = worker->maxactive == 0 ? 64 : 2 * worker->maxactive;
+		worker->active = xrealloc(worker->active, worker->maxactive * sizeof(node_t*));
+	}
 
-    work_t* work = xmalloc(sizeof(work_t));
-    work->type = WORK_RELABEL;
-    work->task.relabel = relabel_task;
-    
-	work->next = *work_list;
-	*work_list = work;
+	worker->active[worker->nactive++] = u;
 }
 
-void free_work_list(work_t* work_list) {
-	pr("freeing work list\n");
-	while (work_list != NULL) {
-		if (work_list->type == WORK_PUSH)
-			free(work_list->task.push);
-		else
-		 	free(work_list->task.relabel);
-		work_t* temp = work_list;
-		work_list = work_list->next;
-		free(temp);
+void free_work(worker_t* worker) {
+	pr("freeing work buffers\n");
+	for (int i = 0; i < worker->g->nthreads; i++) {
+		free(worker->work[i].push);
+		free(worker->work[i].relabel);
 	}
+	free(worker->work);
+	free(worker->active);
 }
 
 
@@ -306,6 +371,273 @@ static int next_int()
         return x;
 }
 
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+/* when fewer than tail nodes are active after a round the main thread
+ * discharges them alone while the workers wait, until no node has
+ * excess or more than twice as many are active again. 0 turns it off.
+ *
+ */
+
+static int		tail = TAIL;
+
+static int parse_tail(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 0 || n > 1 << 24)
+		error("bad tail threshold \"%s\"", s);
+
+	return n;
+}
+
+/* active nodes are given to workers round robin or, by default, to
+ * the worker with the fewest arcs to scan so far in the round.
+ *
+ */
+
+enum { BALANCE_RR, BALANCE_DEGREE };
+
+static int		balance = BALANCE_DEGREE;
+
+/* with -j FILE or PREFLOW_TRACE=FILE what each thread does in each
+ * round is written to FILE at exit, and with -p or PREFLOW_PERF=1 the
+ * perf counters of each kind of span are printed, see trace.h.
+ *
+ */
+
+static const char*	trace_file;
+static int		perf;
+
+static int parse_balance(const char* s)
+{
+	if (strcmp(s, "rr") == 0)
+		return BALANCE_RR;
+	else if (strcmp(s, "degree") == 0)
+		return BALANCE_DEGREE;
+
+	error("bad balance \"%s\": use rr or degree", s);
+
+	return BALANCE_DEGREE;
+}
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+
+	s = getenv("PREFLOW_TAIL");
+	if (s != NULL)
+		tail = parse_tail(s);
+
+	s = getenv("PREFLOW_BALANCE");
+	if (s != NULL)
+		balance = parse_balance(s);
+
+	s = getenv("PREFLOW_TRACE");
+	if (s != NULL)
+		trace_file = s;
+
+	s = getenv("PREFLOW_PERF");
+	if (s != NULL)
+		perf = strcmp(s, "0") != 0;
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:T:b:j:pv")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'b':
+			balance = parse_balance(optarg);
+			break;
+
+		case 'T':
+			tail = parse_tail(optarg);
+			break;
+
+		case 'j':
+			trace_file = optarg;
+			break;
+
+		case 'p':
+			perf = 1;
+			break;
+
+		case 'v':
+			phase_verbose = 1;
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-T tail] [-b rr|degree] [-j trace] [-p] [-v] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+
 static void* xmalloc(size_t s)
 {
 	void*		p;
@@ -355,6 +687,16 @@ static void* xcalloc(size_t n, size_t s)
 	return p;
 }
 
+static void* xrealloc(void* p, size_t s)
+{
+	p = realloc(p, s);
+
+	if (p == NULL)
+		error("out of memory: realloc(%zu) failed", s);
+
+	return p;
+}
+
 static void mutex_lock(pthread_mutex_t* m, const char* name)
 {
 	/* lock a mutex and check that it was successful.
@@ -382,6 +724,7 @@ static void add_edge(node_t* u, edge_t* e)
 	p->edge = e;
 	p->next = u->edge;
 	u->edge = p;
+	u->degree += 1;
 }
 
 static void connect(node_t* u, node_t* v, int c, edge_t* e)
@@ -400,7 +743,7 @@ static void connect(node_t* u, node_t* v, int c, edge_t* e)
 }
 
 #ifdef FORSETE
-static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
+static graph_t* new_graph(FILE* in, int n, int m, int nthreads, trace_t* trace)
 {
 	graph_t*	g;
 	node_t*		u;
@@ -409,8 +752,10 @@ static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
 	int		a;
 	int		b;
 	int		c;
+	double		begin;
 	
 	g = xmalloc(sizeof(graph_t));
+	g->trace = trace;
 
 	g->n = n;
 	g->m = m;
@@ -420,22 +765,56 @@ static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
 
 	g->totalJobs = 0;
 	g->nthreads = nthreads;
-
-	g->worker = xcalloc(nthreads, sizeof(worker_t));
+	g->chunk = (n + nthreads - 1) / nthreads;
+	g->maxscan = 0;
+	g->sumscan = 0;
+	g->maxwork = 0;
+	g->maxround = 0;
+
+	g->worker = aligned_alloc(CACHE_LINE, nthreads * sizeof(worker_t));
+	if (g->worker == NULL)
+		error("out of memory: aligned_alloc failed");
+	memset(g->worker, 0, nthreads * sizeof(worker_t));
+#if STATS
+	memset(&g->stat, 0, sizeof g->stat);
+#endif
 	for (int i = 0; i < nthreads; i += 1) {
 		g->worker[i].i = i;
 		g->worker[i].g = g;
+		g->worker[i].work = xcalloc(nthreads, sizeof(buffer_t));
+	}
+
+	/* the edges are read first and then put in the adjacency lists,
+	 * so that -v can tell how long each takes.
+	 *
+	 */
+
+	begin = trace_time(trace);
+
+	PHASE("parse") {
+		for (i = 0; i < m; i += 1) {
+			a = next_int();
+			b = next_int();
+			c = next_int();
+			g->e[i].u = &g->v[a];
+			g->e[i].v = &g->v[b];
+			g->e[i].c = c;
+		}
 	}
 
-	for (i = 0; i < m; i += 1) {
-		a = next_int();
-		b = next_int();
-		c = next_int();
-		u = &g->v[a];
-		v = &g->v[b];
-		connect(u, v, c, &g->e[i]);
+	trace_span(trace, "parse", begin, 0);
+	begin = trace_time(trace);
+
+	PHASE("build") {
+		for (i = 0; i < m; i += 1) {
+			u = g->e[i].u;
+			v = g->e[i].v;
+			connect(u, v, g->e[i].c, &g->e[i]);
+		}
 	}
 
+	trace_span(trace, "build", begin, 0);
+
 	// switch source and sink here if sounce flow is more than sink flow
 	list_t * p = g->v[0].edge;
 	int sourceTotalFlow = 0;
@@ -465,13 +844,14 @@ static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
 }
 #endif
 
-static void push(graph_t* g, node_t* u, node_t* v, edge_t* e, int df)
+static void push(graph_t* g, node_t* v, edge_t* e, int df)
 {
 
-	pr("push from %d to %d: ", id(g, u), id(g, v));
+	/* the sender already subtracted df from its excess. */
+
+	pr("push to %d: ", id(g, v));
 	pr("f = %d, c = %d, so pushing %d\n", e->f, e->c, df);
 
-	u->e -= abs(df);
 	v->e += abs(df);
 	e->f += df;
 }
@@ -490,27 +870,317 @@ static node_t* other(node_t* u, edge_t* e)
 		return e->u;
 }
 
-static int getNextThreadIndex(graph_t* g)
+static int getNextThreadIndex(graph_t* g, node_t* u)
 {
 	int index = g->totalJobs % g->nthreads;
 	g->totalJobs += 1;
+
+	/* a worker is as late as the arcs it must scan, so give u to
+	 * the one with the fewest so far this round. ties go round robin.
+	 *
+	 */
+
+	if (balance == BALANCE_DEGREE) {
+		for (int i = 0; i < g->nthreads; i += 1)
+			if (g->worker[i].load < g->worker[index].load)
+				index = i;
+
+		g->worker[index].load += u->degree + 1;
+	}
+
 	return index;
 }
 
+static void account_round(graph_t* g, int round)
+{
+	worker_t*	w;
+	long		max;
+	long		sum;
+	size_t		work;
+	int		i;
+
+	/* all workers wait so their counts for the round are final. the
+	 * work of the round is what was in the buffers and the active
+	 * nodes the workers found when applying it.
+	 *
+	 */
+
+	max = 0;
+	sum = 0;
+	work = 0;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		w->total += w->scanned;
+		sum += w->scanned;
+		if (w->scanned > max)
+			max = w->scanned;
+		w->scanned = 0;
+		w->load = 0;
+		work += w->used + w->nactive * sizeof(node_t*);
+		w->used = 0;
+	}
+
+	g->maxscan += max;
+	g->sumscan += sum;
+
+	if (work > g->maxwork) {
+		g->maxwork = work;
+		g->maxround = round;
+	}
+}
+
+static void report_work(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	int		i;
+	int		k;
+
+	/* with -v, a histogram of the arcs each worker scanned, and how much
+	 * longer the rounds took than with a perfect balance, which is
+	 * the largest work of each round summed, against the mean.
+	 *
+	 */
+
+	if (!phase_verbose)
+		return;
+
+	max = 1;
+	for (i = 0; i < g->nthreads; i += 1)
+		if (g->worker[i].total > max)
+			max = g->worker[i].total;
+
+	fprintf(stderr, "arcs scanned per worker, %s assignment:\n",
+		balance == BALANCE_DEGREE ? "degree" : "round robin");
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		fprintf(stderr, "%4d %10ld ", i, w->total);
+		for (k = 0; k < 50 * w->total / max; k += 1)
+			fputc('#', stderr);
+		fputc('\n', stderr);
+	}
+
+	fprintf(stderr, "round imbalance (largest / mean): %.2f\n",
+		g->sumscan == 0 ? 1.0 : (double) g->nthreads * g->maxscan / g->sumscan);
+}
+
+static void report_memory(graph_t* g)
+{
+	size_t		nodes;
+	size_t		edges;
+	size_t		lists;
+	size_t		workers;
+
+	/* what the graph takes with -v. every edge is in two adjacency
+	 * lists, and since each link is malloced by itself malloc uses
+	 * more than this for them, which shows in peak_rss. each worker
+	 * has a buffer for the range of every worker.
+	 *
+	 */
+
+	nodes = g->n * sizeof(node_t);
+	edges = g->m * sizeof(edge_t);
+	lists = 2 * (size_t) g->m * sizeof(list_t);
+	workers = g->nthreads * (sizeof(worker_t) + g->nthreads * sizeof(buffer_t));
+
+	memory_print("nodes", nodes, g->n, g->m);
+	memory_print("edges", edges, g->n, g->m);
+	memory_print("lists", lists, g->n, g->m);
+	memory_print("workers", workers, g->n, g->m);
+	memory_print("graph", sizeof(graph_t) + nodes + edges + lists + workers, g->n, g->m);
+}
+
+static void report_work_memory(graph_t* g)
+{
+	worker_t*	w;
+	buffer_t*	b;
+	size_t		size;
+	int		i;
+	int		j;
+
+	/* the buffers only grow, so what they have now is the most they
+	 * ever had, while work_peak is the most that was used in a round.
+	 *
+	 */
+
+	size = 0;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		size += w->maxactive * sizeof(node_t*);
+		for (j = 0; j < g->nthreads; j += 1) {
+			b = &w->work[j];
+			size += b->maxpush * sizeof(push_t) + b->maxrelabel * sizeof(relabel_t);
+		}
+	}
+
+	memory_print("work_peak", g->maxwork, g->n, g->m);
+	memory_print("work_buffers", size, g->n, g->m);
+
+	if (phase_verbose)
+		fprintf(stderr, "memory work_peak_round: %d\n", g->maxround);
+}
+
+#if STATS
+static void report_stats(graph_t* g, int round)
+{
+	stat_t		sum;
+	worker_t*	w;
+	int		i;
+
+	sum = g->stat;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		sum.pushes += w->stat.pushes;
+		sum.saturating += w->stat.saturating;
+		sum.relabels += w->stat.relabels;
+		sum.discharges += w->stat.discharges;
+		sum.scans += w->total;
+	}
+
+	fprintf(stderr, "stat rounds: %d\n", round);
+	fprintf(stderr, "stat discharges: %ld\n", sum.discharges);
+	fprintf(stderr, "stat pushes: %ld\n", sum.pushes);
+	fprintf(stderr, "stat saturating: %ld\n", sum.saturating);
+	fprintf(stderr, "stat nonsaturating: %ld\n", sum.pushes - sum.saturating);
+	fprintf(stderr, "stat relabels: %ld\n", sum.relabels);
+	fprintf(stderr, "stat arcs_scanned: %ld\n", sum.scans);
+	fprintf(stderr, "stat idle_main: %.3f ms\n", g->stat.idle * 1e3);
+
+	for (i = 0; i < g->nthreads; i += 1)
+		fprintf(stderr, "stat idle_%d: %.3f ms\n", i, g->worker[i].stat.idle * 1e3);
+}
+#endif
+
+static int bucket(graph_t* g, node_t* u)
+{
+	return id(g, u) / g->chunk;
+}
+
+static void assignNodeToThread(graph_t* g, node_t* u)
+{
+	int index = getNextThreadIndex(g, u);
+	worker_t* worker = &g->worker[index];
+	u->next = worker->excess;
+	worker->excess = u;
+	pr("added node %d with excess %d to thread %d\n", id(g, u),u->e, index);
+}
+
 void allocateNodeToThread(graph_t* g, node_t* u)
 {
 	if (u != g->s && u != g->t && u->in_queue == 0) {
 		u->in_queue = 1;
-		int index = getNextThreadIndex(g);
-		worker_t* worker = &g->worker[index];
-		u->next = worker->excess;
-		worker->excess = u;
-		pr("added node %d with excess %d to thread %d\n", id(g, u),u->e, index);
+		assignNodeToThread(g, u);
 	} else {
 		pr("skipping adding s or t to excess list\n");
 	}
 }
 
+static int discharge_sequential(graph_t* g, node_t* excess, int active, int limit)
+{
+	node_t*		s = g->s;
+	node_t*		t = g->t;
+	node_t*		u;
+	node_t*		v;
+	edge_t*		e;
+	list_t*		p;
+	int		b;
+	int		df;
+
+	/* discharge the active nodes on this thread, as in lab 0, while
+	 * the workers wait for the next round. it stops when no node has
+	 * excess or when more than limit nodes have, and then gives the
+	 * nodes left to the workers. returns how many that was.
+	 *
+	 */
+
+	while ((u = excess) != NULL && active <= limit) {
+		excess = u->next;
+		u->next = NULL;
+		active -= 1;
+		stat_add(&g->stat, discharges, 1);
+
+		for (p = u->edge; p != NULL && u->e > 0; p = p->next) {
+			e = p->edge;
+			stat_add(&g->stat, scans, 1);
+
+			if (u == e->u) {
+				v = e->v;
+				b = 1;
+			} else {
+				v = e->u;
+				b = -1;
+			}
+
+			if (u->h > v->h && b * e->f < e->c) {
+				df = MIN(u->e, e->c - b * e->f);
+				u->e -= df;
+				v->e += df;
+				e->f += b * df;
+				stat_add(&g->stat, pushes, 1);
+				stat_add(&g->stat, saturating, b * e->f == e->c);
+
+				if (v != s && v != t && v->in_queue == 0) {
+					v->in_queue = 1;
+					v->next = excess;
+					excess = v;
+					active += 1;
+				}
+			}
+		}
+
+		if (u->e > 0) {
+			relabel(g, u);
+			stat_add(&g->stat, relabels, 1);
+			u->next = excess;
+			excess = u;
+			active += 1;
+		} else
+			u->in_queue = 0;
+	}
+
+	while ((u = excess) != NULL) {
+		excess = u->next;
+		assignNodeToThread(g, u);
+	}
+
+	return active;
+}
+
+static void apply_work(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+	buffer_t*	b;
+	node_t*		v;
+	int			i;
+	int			j;
+
+	/* apply the work of all workers for nodes in our range. */
+
+	for (i = 0; i < g->nthreads; i++) {
+		b = &g->worker[i].work[worker->i];
+
+		for (j = 0; j < b->nrelabel; j++)
+			relabel(g, b->relabel[j].u);
+
+		for (j = 0; j < b->npush; j++) {
+			v = b->push[j].v;
+			push(g, v, b->push[j].e, b->push[j].d);
+			if (v != g->s && v != g->t && v->in_queue == 0) {
+				v->in_queue = 1;
+				add_active(worker, v);
+			}
+		}
+
+		worker->used += b->npush * sizeof(push_t) + b->nrelabel * sizeof(relabel_t);
+		b->nrelabel = 0;
+		b->npush = 0;
+	}
+}
+
 void *printGraphState(graph_t* g){
 	for (int i = 0; i < g->n; i += 1) {
 		node_t *node = &g->v[i];
@@ -529,11 +1199,20 @@ void *work(void* args)
 	int		b;
 	int 	df;
 	int 	u_e; 
+	double	idle;
+	double	begin;
+	long	round;
+	char	name[32];
+
+	snprintf(name, sizeof name, "worker %d", worker->i);
+	worker->trace = trace_thread(worker->i + 1, name);
+
+	for (round = 1; ; round += 1) {
+		begin = trace_time(worker->trace);
 
-	while (1) {
 		node_t* u = worker->excess;
 		while (u != NULL) {
-			worker->nbrJobs++;
+			stat_add(&worker->stat, discharges, 1);
 			u_e = u->e; //excess flow of u
 			p = u->edge;
 			int pushed = 0;
@@ -542,6 +1221,7 @@ void *work(void* args)
 			while (p != NULL && u_e > 0) {
 				e = p->edge;
 				p = p->next;
+				worker->scanned += 1;
 
 				if (u == e->u) {
 					v = e->v;
@@ -556,7 +1236,8 @@ void *work(void* args)
 				if (u->h == 0) {
 					//do reabel
 					pr("create relabel work for node @%d\n", id(g, u));
-					create_relabel_work(&worker->work, u);
+					create_relabel_work(&worker->work[bucket(g, u)], u);
+					stat_add(&worker->stat, relabels, 1);
 					pushed = 1;
 					break;
 				}
@@ -569,7 +1250,9 @@ void *work(void* args)
 						df = -MIN(u_e, e->c + e->f); //This flow must be negative
 					}
 					u_e -= abs(df);
-					create_push_work(&worker->work, u, v, e, df);
+					create_push_work(&worker->work[bucket(g, v)], v, e, df);
+					stat_add(&worker->stat, pushes, 1);
+					stat_add(&worker->stat, saturating, b * (e->f + df) == e->c);
 					pr("@T%d: create push work from node @%d to node @%d, df = %d\n", worker->i, id(g, u), id(g, v), df);
 					pushed = 1;
 				}
@@ -579,16 +1262,44 @@ void *work(void* args)
 			//2. if not pushed, reabel
 			if (!pushed && u_e> 0) {
 				pr("@T%d: no push possible, relabel node @%d\n", worker->i, id(g, u));
-				create_relabel_work(&worker->work, u);
+				create_relabel_work(&worker->work[bucket(g, u)], u);
+				stat_add(&worker->stat, relabels, 1);
 			}
 			node_t* temp = u;
 			u = u->next;
-			temp->in_queue = 0;
 			temp->next = NULL;
+
+			/* nobody else looks at the excess of temp in this
+			 * round so what was pushed away is subtracted here.
+			 *
+			 */
+
+			temp->e = u_e;
+			if (u_e > 0)
+				add_active(worker, temp);
+			else
+				temp->in_queue = 0;
 		}
 
 		worker->excess = NULL;
 
+		trace_span(worker->trace, "discharge", begin, round);
+		begin = trace_time(worker->trace);
+
+		idle = stat_time();
+		pthread_barrier_wait(&g->barrier);
+		stat_add(&worker->stat, idle, stat_time() - idle);
+
+		trace_span(worker->trace, "barrier", begin, round);
+		begin = trace_time(worker->trace);
+
+		apply_work(worker);
+
+		trace_span(worker->trace, "apply", begin, round);
+		begin = trace_time(worker->trace);
+
+		idle = stat_time();
+
 		pthread_mutex_lock(&mutex);
 		waitingWorkers++;
 
@@ -600,10 +1311,14 @@ void *work(void* args)
 
 		if (allDone) {
 			pthread_mutex_unlock(&mutex);
+			stat_add(&worker->stat, idle, stat_time() - idle);
+			trace_span(worker->trace, "handshake", begin, round);
 			return 0;
 		}
 
 		pthread_mutex_unlock(&mutex);
+		stat_add(&worker->stat, idle, stat_time() - idle);
+		trace_span(worker->trace, "handshake", begin, round);
 	}
 }
 	
@@ -616,7 +1331,17 @@ int preflow(graph_t* g)
 	edge_t*		e;
 	list_t*		p;
 
+	node_t*		excess;
+	int		round;
+	int		active;
+	double		idle;
+	double		begin;
+	trace_t*	trace;
+
 	int nthreads = g->nthreads;
+
+	trace = g->trace;
+	begin = trace_time(trace);
 	
 	s = g->s;
 	t = g->t;
@@ -632,6 +1357,7 @@ int preflow(graph_t* g)
 	 *
 	 */
 	pthread_t thread[nthreads];
+	pthread_attr_t	attr;
 
 	//  Start by pushing from source
 	int totalPushed = 0;
@@ -661,46 +1387,79 @@ int preflow(graph_t* g)
 
 
 	s->e -= totalPushed;
+
+	pthread_barrier_init(&g->barrier, NULL, nthreads);
 	
 	// Start working threads
 	for (int i = 0; i < nthreads; i += 1) {
-		if (pthread_create(&thread[i], NULL, work, (void *) &g->worker[i])) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
 			error("pthread_create failed");
 		}
+		pthread_attr_destroy(&attr);
 	}
 
-	while(1) {
+	trace_span(trace, "start", begin, 0);
+
+	for (round = 1; ; round += 1) {
+		idle = stat_time();
+		begin = trace_time(trace);
+
         pthread_mutex_lock(&mutex);
 		while (waitingWorkers < nthreads) {
 			pthread_cond_wait(&cond_main, &mutex);
 		}
 
-		int first = 1;
-		for (int i = 0; i < nthreads; i++) {
-			work_t* w = g->worker[i].work;
-			while (w != NULL) {
-				if (w->type == WORK_PUSH) {
-					push(g, w->task.push->u, w->task.push->v, w->task.push->e, w->task.push->d);
-					allocateNodeToThread(g, w->task.push->v);
-					if (w->task.push->u->e > 0)
-						allocateNodeToThread(g, w->task.push->u);
-					first = 0;
-				} else {
-					relabel(g, w->task.relabel->u);
-					allocateNodeToThread(g, w->task.relabel->u);
-					first = 0;
+		stat_add(&g->stat, idle, stat_time() - idle);
+		trace_span(trace, "wait", begin, round);
+		begin = trace_time(trace);
+
+		account_round(g, round);
+
+		active = 0;
+		for (int i = 0; i < nthreads; i++)
+			active += g->worker[i].nactive;
+
+		int drained = active == 0;
+
+		if (active < tail) {
+			excess = NULL;
+			for (int i = 0; i < nthreads; i++) {
+				worker_t* w = &g->worker[i];
+				for (int j = 0; j < w->nactive; j++) {
+					w->active[j]->next = excess;
+					excess = w->active[j];
 				}
-				w = w->next;
+				w->nactive = 0;
+			}
+
+			if (active > 0) {
+				if (phase_verbose)
+					fprintf(stderr, "round %d: %d active, sequential\n", round, active);
+				trace_span(trace, "assign", begin, round);
+				begin = trace_time(trace);
+				active = discharge_sequential(g, excess, active, 2 * tail);
+				trace_span(trace, "sequential", begin, round);
+				begin = trace_time(trace);
+				if (phase_verbose && active > 0)
+					fprintf(stderr, "round %d: %d active, parallel\n", round, active);
 			}
-			free_work_list(g->worker[i].work);
-			g->worker[i].work = NULL;
 		}
 
-		if (first) {
+		for (int i = 0; i < nthreads; i++) {
+			worker_t* w = &g->worker[i];
+			for (int j = 0; j < w->nactive; j++)
+				assignNodeToThread(g, w->active[j]);
+			w->nactive = 0;
+		}
+
+		if (drained && -s->e != t->e) {
 			pr("error: s->e = %d, t->e = %d\n", s->e, t->e);
 			return -1;
 		}
 
+		trace_span(trace, "assign", begin, round);
+
 		if (-s->e == t->e) {
 			allDone = 1;
 			pthread_cond_broadcast(&cond_worker);
@@ -717,10 +1476,6 @@ int preflow(graph_t* g)
 		pthread_mutex_unlock(&mutex);
 	}
 
-	for (int i = 0; i < nthreads; i++) {
-		printf("%d\n", g->worker[i].nbrJobs);
-	}
-
 	for (int i = 0; i< nthreads; i += 1) {
 		pr("joining thread %d\n", i);
 		if (pthread_join(thread[i], NULL) != 0)  {
@@ -728,6 +1483,14 @@ int preflow(graph_t* g)
 		}
 	}
 
+	pthread_barrier_destroy(&g->barrier);
+
+	report_work(g);
+#if STATS
+	report_stats(g, round);
+#endif
+	report_work_memory(g);
+
 	return t->e;
 }
 
@@ -746,6 +1509,10 @@ static void free_graph(graph_t* g)
 			p = q;
 		}
 	}
+	for (i = 0; i < g->nthreads; i += 1)
+		free_work(&g->worker[i]);
+
+	free(g->worker);
 	free(g->v);
 	free(g->e);
 	free(g);
@@ -759,6 +1526,8 @@ int main(int argc, char* argv[])
 	int		f;	/* output from preflow.		*/
 	int		n;	/* number of nodes.		*/
 	int		m;	/* number of edges.		*/
+	trace_t*	trace;	/* of the main thread.		*/
+	double		begin;
 
 	progname = argv[0];	/* name is a string in argv[0]. */
 
@@ -771,17 +1540,37 @@ int main(int argc, char* argv[])
 	next_int();
 	next_int();
 
-	int nthreads = 10;
+	int nthreads = options(argc, argv);
 
-	g = new_graph(in, n, m, nthreads);
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
+
+	trace_open(trace_file, perf);
+	trace = trace_thread(0, "main");
+
+	g = new_graph(in, n, m, nthreads, trace);
 
 	fclose(in);
 
-	f = preflow(g);
+	report_memory(g);
+
+	PHASE("solve") {
+		f = preflow(g);
+	}
 
 	printf("f = %d\n", f);
 
-	free_graph(g);
+	memory_peak();
+
+	begin = trace_time(trace);
+
+	PHASE("teardown") {
+		free_graph(g);
+	}
+
+	trace_span(trace, "teardown", begin, 0);
 
 	return 0;
 }
@@ -27,17 +27,47 @@
  *
  */
  
+#define _GNU_SOURCE
+
 #include <alloca.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <unistd.h>
+#include "timebase.h"
+#include "trace.h"
+#include "pthread_barrier.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #define PRINT	0	/* enable/disable prints. */
+#define CACHE_LINE	64	/* bytes in a cache block.	*/
+
+#ifndef STATS
+#define STATS	0	/* count operations, see stat_t.	*/
+#endif
+
+#ifndef CONTENTION
+#define CONTENTION	0	/* time atomics, see contention_t.	*/
+#endif
+
+#ifndef SAMPLE
+#define SAMPLE	64	/* atomic adds per timed one.	*/
+#endif
+
+#ifndef TOP
+#define TOP	20	/* hottest nodes printed.	*/
+#endif
 
 /* the funny do-while next clearly performs one iteration of the loop.
  * if you are really curious about why there is a loop, please check
@@ -53,8 +83,20 @@
 #define pr(...)		/* no effect at all */
 #endif
 
+#define TAIL	32	/* default active nodes for sequential tail. */
+#define GLOBAL	1	/* relabels per node between global relabels. */
+#define HUB	256	/* default arcs per slice of a split hub. */
+
 #define MIN(a,b)	(((a)<=(b))?(a):(b))
 
+#if STATS
+#define stat_add(s, x, n)	((s)->x += (n))
+#define stat_time()		timebase_sec()
+#else
+#define stat_add(s, x, n)	((void) (n))
+#define stat_time()		0.0
+#endif
+
 /* introduce names for some structs. a struct is like a class, except
  * it cannot be extended and has no member methods, and everything is
  * public.
@@ -67,26 +109,30 @@
 typedef struct graph_t	graph_t;
 typedef struct node_t	node_t;
 typedef struct edge_t	edge_t;
-typedef struct list_t	list_t;
 typedef struct worker_t worker_t;
+typedef struct delta_t	delta_t;
+typedef struct slice_t	slice_t;
+typedef struct stat_t	stat_t;
+typedef struct contention_t	contention_t;
+typedef struct hot_t	hot_t;
 typedef enum WORK_TYPE {
 	WORK_PUSH,
 	WORK_RELABEL
 } work_type;
 
-struct list_t {
-	edge_t*		edge;
-	list_t*		next;
-};
-
 struct node_t {
 	int			h;		/* height.			*/
 	int			e;		/* excess flow.			*/
-	list_t*		edge;	/* adjacency list.		*/
+	edge_t**	arc;	/* degree arcs in g->arc.	*/
 	node_t*		next;	/* with excess preflow.		*/
 	int 		in_queue;
+	int			degree;	/* number of arcs.		*/
 	node_t*     next_delta_e;
 	int 		has_delta_e;
+	int		hub;	/* nonzero if arcs are split.	*/
+	_Atomic int	avail;	/* excess the slices may push.	*/
+	_Atomic int	slices;	/* slices not yet discharged.	*/
+	_Atomic int	pushed;	/* nonzero if some slice pushed. */
 };
 
 struct edge_t {
@@ -96,6 +142,73 @@ struct edge_t {
 	int			c;	/* capacity.			*/
 };
 
+/* what the workers want done to a node at the end of a round. the two
+ * fields are kept together so that one cache block holds the deltas
+ * and relabel flags of CACHE_LINE / sizeof(delta_t) consecutive nodes.
+ *
+ */
+
+struct delta_t {
+	_Atomic int32_t	e;		/* change of excess flow.	*/
+	_Atomic int32_t	relabel;	/* nonzero if u should be relabeled. */
+};
+
+/* a range of the arcs of a hub, discharged by one worker while other
+ * workers discharge the rest of its arcs.
+ *
+ */
+
+struct slice_t {
+	node_t*		u;	/* the hub.			*/
+	int		begin;	/* first arc index.		*/
+	int		end;	/* one past the last.		*/
+	int		budget;	/* excess it may push with -d.	*/
+};
+
+/* what one thread did, counted with -DSTATS=1 and printed as "stat
+ * NAME: X" lines at the end. each thread has its own in a cache block
+ * of its own so that the counting causes no false sharing, and they
+ * are added up when the threads are done. pushes, relabels and arcs
+ * scanned in parallel are counted anyway.
+ *
+ */
+
+#if STATS
+struct stat_t {
+	long		saturating;	/* pushes which filled the arc.	*/
+	long		discharges;	/* active nodes discharged.	*/
+	long		scans;	/* arcs scanned by main.	*/
+	double		idle;	/* seconds waiting for others.	*/
+} __attribute__((aligned(CACHE_LINE)));
+#endif
+
+/* how the atomics of one thread went, with -DCONTENTION=1, printed
+ * as "contention ..." lines at the end. every SAMPLE:th add to a delta
+ * by a thread is timed, since an add which has to take the cache block
+ * from another cpu takes longer, and the time is also added to the
+ * node. the compare and swap which takes excess from a hub is timed
+ * whenever it has to be retried, which only happens when another
+ * slice took from it in between.
+ *
+ */
+
+struct contention_t {
+	long		adds;		/* atomic adds to deltas.	*/
+	long		timed;		/* of them timed.		*/
+	double		add;		/* seconds in the timed adds.	*/
+	long		swaps;		/* compare and swaps on avail.	*/
+	long		retries;	/* of them which failed.	*/
+	double		wait;		/* seconds retrying them.	*/
+} __attribute__((aligned(CACHE_LINE)));
+
+/* the sampled waits for the atomics of one node, from all threads. */
+
+struct hot_t {
+	_Atomic long	samples;	/* timed adds and retried swaps. */
+	_Atomic long	retries;
+	_Atomic long	wait;		/* nanoseconds.			*/
+};
+
 struct graph_t {
 	int		n;	/* nodes.			*/
 	int		m;	/* edges.			*/
@@ -104,14 +217,59 @@ struct graph_t {
 	worker_t* 	worker;
 	node_t*		v;	/* array of n nodes.		*/
 	edge_t*		e;	/* array of m edges.		*/
+	edge_t**	arc;	/* 2m arcs, those of node 0 first. */
+	int*		head;	/* node at the other end of each arc. */
+	int*		side;	/* 2 * edge index, + 1 if from e->v.	*/
+	long*		count;	/* arcs per worker and owner in build. */
+	int*		bucket;	/* arcs sorted by owner in build. */
+	double		begin;	/* timebase_sec() when preflow started. */
+	double		read;	/* seconds to read the input.	*/
+	double		build;	/* seconds to build the arcs.	*/
+	double		first;	/* seconds until the first round. */
 	node_t*		s;	/* source.			*/
 	node_t*		t;	/* sink.			*/
+	delta_t*	delta;	/* array of n deltas, one per node. */
+	pthread_barrier_t start;	/* workers wait until delta is zeroed. */
+	_Atomic int*	dist;	/* distance to t in global relabel. */
+	_Atomic int	found;	/* nodes with a distance.	*/
+	int		global;	/* do a global relabel this round. */
+	long		relabels;	/* relabels done by main thread. */
+	long		pushes;	/* pushes done by main thread.	*/
+#if STATS
+	stat_t		stat;	/* of the main thread.		*/
+#endif
+	trace_t*	trace;	/* of the main thread.		*/
+	hot_t*		hot;	/* n nodes with -DCONTENTION=1.	*/
+	double		bfs;	/* seconds in global relabel.	*/
+	long		maxscan;	/* sum of the largest scanned per round. */
+	long		sumscan;	/* sum of all scanned per round. */
+	size_t		maxwork;	/* most bytes of slices in a round. */
+	int		maxround;	/* the round with maxwork.	*/
 };
 
 struct worker_t {
 	int			i;
 	graph_t*	g;
 	node_t*		excess;	/* nodes with e > 0 except s,t.	*/
+	node_t**	cur;	/* frontier we found last level. */
+	int		ncur;
+	int		maxcur;
+	node_t**	next;	/* frontier we find this level. */
+	int		nnext;
+	int		maxnext;
+	long		load;	/* degrees given to us this round. */
+	long		scanned;	/* arcs scanned this round.	*/
+	long		total;	/* arcs scanned in all rounds.	*/
+	long		arcs;	/* arcs of our nodes in the build. */
+	long		pushes;	/* pushes in all rounds.	*/
+#if STATS
+	stat_t		stat;
+#endif
+	contention_t	contention;
+	slice_t*	slice;	/* hub slices given this round.	*/
+	int		nslice;
+	int		maxslice;
+	trace_t*	trace;	/* NULL unless tracing.		*/
 };
 
 pthread_cond_t cond_main = PTHREAD_COND_INITIALIZER;
@@ -121,9 +279,6 @@ pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 int waitingWorkers = 0;
 int allDone = 0;
 
-static _Atomic int32_t delta_excess[20000];
-static _Atomic int32_t relabels[20000];
-
 static void* xmalloc(size_t s);
 
 static char* progname;
@@ -145,187 +300,1761 @@ void error(const char* fmt, ...)
 	if (progname != NULL)
 		fprintf(stderr, "%s: ", progname);
 
-	fprintf(stderr, "error: %s\n", buf);
-	exit(1);
+	fprintf(stderr, "error: %s\n", buf);
+	exit(1);
+}
+
+static int next_int()
+{
+        int     x;
+        int     c;
+
+	x = 0;
+        while (isdigit(c = getchar()))
+                x = 10 * x + c - '0';
+
+        return x;
+}
+
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+/* when fewer than tail nodes are active after a round the main thread
+ * discharges them alone while the workers wait, until no node has
+ * excess or more than twice as many are active again. 0 turns it off.
+ *
+ */
+
+static int		tail = TAIL;
+
+/* a global relabel is done after the first round and then whenever
+ * there have been global * n relabels since the last one. 0 turns it
+ * off.
+ *
+ */
+
+static int		global = GLOBAL;
+
+/* a node with at least 2 * hub arcs is a hub, and when it is active
+ * its arcs are split in slices of at least hub arcs which different
+ * workers push along at the same time. 0 turns it off.
+ *
+ */
+
+static int		hub = HUB;
+
+/* with -d the slices of a hub get fixed shares of its excess from the
+ * main thread instead of taking what is left when they come to it, so
+ * that every push and relabel depends only on the round and not on
+ * which worker gets there first.
+ *
+ */
+
+static int		deterministic;
+
+static int parse_count(const char* s, const char* what)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 0 || n > 1 << 24)
+		error("bad %s \"%s\"", what, s);
+
+	return n;
+}
+
+/* active nodes are given to workers round robin or, by default, to
+ * the worker with the fewest arcs to scan so far in the round.
+ *
+ */
+
+enum { BALANCE_RR, BALANCE_DEGREE };
+
+static int		balance = BALANCE_DEGREE;
+
+/* the admissible arc search and the lowest residual neighbor used by
+ * the discharge loops have a scalar version and, on x86-64 machines
+ * with avx2, a version which looks at eight arcs at a time. the best
+ * one the cpu has is used unless -k or PREFLOW_KERNEL says otherwise.
+ *
+ */
+
+enum { KERNEL_AUTO, KERNEL_SCALAR, KERNEL_AVX2 };
+
+static int		kernel = KERNEL_AUTO;
+
+static int parse_kernel(const char* s)
+{
+	if (strcmp(s, "scalar") == 0)
+		return KERNEL_SCALAR;
+	else if (strcmp(s, "avx2") == 0)
+		return KERNEL_AVX2;
+
+	error("bad kernel \"%s\": use scalar or avx2", s);
+
+	return KERNEL_AUTO;
+}
+
+/* with -j FILE or PREFLOW_TRACE=FILE what each thread does in each
+ * round is written to FILE at exit, and with -p or PREFLOW_PERF=1 the
+ * perf counters of each kind of span are printed, see trace.h.
+ *
+ */
+
+static const char*	trace_file;
+static int		perf;
+
+static int parse_balance(const char* s)
+{
+	if (strcmp(s, "rr") == 0)
+		return BALANCE_RR;
+	else if (strcmp(s, "degree") == 0)
+		return BALANCE_DEGREE;
+
+	error("bad balance \"%s\": use rr or degree", s);
+
+	return BALANCE_DEGREE;
+}
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+
+	s = getenv("PREFLOW_TAIL");
+	if (s != NULL)
+		tail = parse_count(s, "tail threshold");
+
+	s = getenv("PREFLOW_GLOBAL");
+	if (s != NULL)
+		global = parse_count(s, "global relabel frequency");
+
+	s = getenv("PREFLOW_KERNEL");
+	if (s != NULL)
+		kernel = parse_kernel(s);
+
+	s = getenv("PREFLOW_HUB");
+	if (s != NULL)
+		hub = parse_count(s, "hub slice size");
+
+	s = getenv("PREFLOW_BALANCE");
+	if (s != NULL)
+		balance = parse_balance(s);
+
+	s = getenv("PREFLOW_DETERMINISTIC");
+	if (s != NULL)
+		deterministic = strcmp(s, "0") != 0;
+
+	s = getenv("PREFLOW_TRACE");
+	if (s != NULL)
+		trace_file = s;
+
+	s = getenv("PREFLOW_PERF");
+	if (s != NULL)
+		perf = strcmp(s, "0") != 0;
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:T:g:b:H:k:dj:pv")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'b':
+			balance = parse_balance(optarg);
+			break;
+
+		case 'T':
+			tail = parse_count(optarg, "tail threshold");
+			break;
+
+		case 'g':
+			global = parse_count(optarg, "global relabel frequency");
+			break;
+
+		case 'H':
+			hub = parse_count(optarg, "hub slice size");
+			break;
+
+		case 'k':
+			kernel = parse_kernel(optarg);
+			break;
+
+		case 'd':
+			deterministic = 1;
+			break;
+
+		case 'j':
+			trace_file = optarg;
+			break;
+
+		case 'p':
+			perf = 1;
+			break;
+
+		case 'v':
+			phase_verbose = 1;
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-T tail] [-g global] [-b rr|degree] [-H hub] [-k scalar|avx2] [-d] [-j trace] [-p] [-v] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+
+static void* xmalloc(size_t s)
+{
+	void*		p;
+
+	p = malloc(s);
+
+	if (p == NULL)
+		error("out of memory: malloc(%zu) failed", s);
+
+	return p;
+}
+
+static void* xcalloc(size_t n, size_t s)
+{
+	void*		p;
+
+	p = xmalloc(n * s);
+
+	memset(p, 0, n * s);
+
+
+	return p;
+}
+
+static void* xaligned_alloc(size_t n, size_t s)
+{
+	void*		p;
+	size_t		size;
+
+	/* allocate n * s bytes starting at a cache block and rounded up
+	 * to whole cache blocks. the memory is not touched here so that
+	 * each page is placed near the thread that first writes to it.
+	 *
+	 */
+
+	size = (n * s + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	if (size == 0)
+		size = CACHE_LINE;
+
+	p = aligned_alloc(CACHE_LINE, size);
+
+	if (p == NULL)
+		error("out of memory: aligned_alloc(%zu) failed", size);
+
+	return p;
+}
+
+static void* xrealloc(void* p, size_t s)
+{
+	p = realloc(p, s);
+
+	if (p == NULL)
+		error("out of memory: realloc(%zu) failed", s);
+
+	return p;
+}
+
+static void mutex_lock(pthread_mutex_t* m, const char* name)
+{
+	/* lock a mutex and check that it was successful.
+	 *
+	 * the pthread_mutex_lock function returns 0 if the lock
+	 * was successful and otherwise an error code.
+	 *
+	 */
+	// pr("locking mutex %s\n", name);
+	if (pthread_mutex_lock(m) != 0)
+		error("mutex lock failed");
+
+}
+
+static void wait_start(worker_t* worker)
+{
+	double		begin;
+
+	/* the time at the barrier is idle time of the worker. */
+
+	begin = stat_time();
+	pthread_barrier_wait(&worker->g->start);
+	stat_add(&worker->stat, idle, stat_time() - begin);
+}
+
+#if CONTENTION
+static void add_hot(graph_t* g, node_t* u, long retries, double wait)
+{
+	hot_t*		hot = &g->hot[id(g, u)];
+
+	atomic_fetch_add_explicit(&hot->samples, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hot->retries, retries, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hot->wait, (long) (wait * 1e9), memory_order_relaxed);
+}
+#endif
+
+static void add_delta(worker_t* worker, node_t* u, int x)
+{
+	graph_t*	g = worker->g;
+#if CONTENTION
+	contention_t*	c = &worker->contention;
+	double		begin;
+	double		wait;
+
+	c->adds += 1;
+
+	if (c->adds % SAMPLE == 0) {
+		begin = timebase_sec();
+		atomic_fetch_add_explicit(&g->delta[id(g, u)].e, x, memory_order_relaxed);
+		wait = timebase_sec() - begin;
+
+		c->timed += 1;
+		c->add += wait;
+		add_hot(g, u, 0, wait);
+		return;
+	}
+#endif
+
+	atomic_fetch_add_explicit(&g->delta[id(g, u)].e, x, memory_order_relaxed);
+}
+
+static int take_avail(worker_t* worker, node_t* u, int* have, int room)
+{
+	int		df;
+#if CONTENTION
+	contention_t*	c = &worker->contention;
+	double		begin = 0;
+	double		wait;
+	long		retries = 0;
+#endif
+
+	/* take what fits in the arc from the excess of the hub u, and
+	 * try again with what is left if another slice took some in
+	 * between.
+	 *
+	 */
+
+	while ((df = MIN(*have, room)) > 0 && !atomic_compare_exchange_weak_explicit(&u->avail,
+		have, *have - df, memory_order_relaxed, memory_order_relaxed)) {
+#if CONTENTION
+		if (retries++ == 0)
+			begin = timebase_sec();
+#endif
+	}
+
+#if CONTENTION
+	c->swaps += 1;
+
+	if (retries > 0) {
+		wait = timebase_sec() - begin;
+		c->retries += retries;
+		c->wait += wait;
+		add_hot(worker->g, u, retries, wait);
+	}
+#else
+	(void) worker;
+#endif
+
+	return df;
+}
+
+static int node_chunk(graph_t* g)
+{
+	int		per_line;
+	int		chunk;
+
+	/* the nodes whose deltas a worker first touches. ranges are whole
+	 * cache blocks of the delta array so that no block is shared by
+	 * two workers.
+	 *
+	 */
+
+	per_line = CACHE_LINE / sizeof(delta_t);
+	chunk = (g->n + g->nthreads - 1) / g->nthreads;
+	return (chunk + per_line - 1) / per_line * per_line;
+}
+
+static void node_range(worker_t* worker, int* begin, int* end)
+{
+	int		chunk = node_chunk(worker->g);
+
+	*begin = MIN((long) worker->i * chunk, worker->g->n);
+	*end = MIN(*begin + chunk, worker->g->n);
+}
+
+static void* build(void* arg)
+{
+	worker_t*	worker = arg;
+	graph_t*	g = worker->g;
+	node_t*		u;
+	node_t*		v;
+	edge_t*		e;
+	long*		count;
+	int		nthreads = g->nthreads;
+	long		next[nthreads];
+	int		chunk;
+	int		begin;
+	int		end;
+	int		first;
+	int		last;
+	int		a;
+	int		i;
+	int		j;
+	long		k;
+	long		b;
+	long		c;
+	double		span;
+	char		name[32];
+
+	/* the arcs of all nodes are in g->arc, those of node 0 first,
+	 * then those of node 1 and so on. each worker puts the arcs of
+	 * its share of the edges in buckets, one for the worker owning
+	 * the node of each arc, and then counts and places the arcs of
+	 * its own nodes from its buckets of all workers. the buckets of
+	 * an owner have those of the last worker first and each worker
+	 * goes through its edges backwards, so the last edge of the input
+	 * comes first, as it did in the adjacency lists, and the order
+	 * does not depend on thread timing.
+	 *
+	 */
+
+	snprintf(name, sizeof name, "worker %d", worker->i);
+	worker->trace = trace_thread(worker->i + 1, name);
+	span = trace_time(worker->trace);
+
+	chunk = node_chunk(g);
+	node_range(worker, &begin, &end);
+	first = (long) worker->i * g->m / nthreads;
+	last = (long) (worker->i + 1) * g->m / nthreads;
+	count = g->count + (size_t) worker->i * nthreads;
+
+	/* count in next so that no cache block of g->count is written
+	 * by two workers for every edge.
+	 *
+	 */
+
+	for (a = 0; a < nthreads; a += 1)
+		next[a] = 0;
+
+	for (i = first; i < last; i += 1) {
+		e = &g->e[i];
+		next[id(g, e->u) / chunk] += 1;
+		next[id(g, e->v) / chunk] += 1;
+	}
+
+	for (a = 0; a < nthreads; a += 1)
+		count[a] = next[a];
+
+	pthread_barrier_wait(&g->start);
+
+	worker->arcs = 0;
+	for (j = 0; j < nthreads; j += 1)
+		worker->arcs += g->count[(size_t) j * nthreads + worker->i];
+
+	pthread_barrier_wait(&g->start);
+
+	/* the arcs of an owner are where its nodes will have them, so
+	 * the bucket of owner a starts after the arcs of the owners before
+	 * it and, in it, ours after those of the workers after us.
+	 *
+	 */
+
+	k = 0;
+	for (a = 0; a < nthreads; a += 1) {
+		next[a] = k;
+		for (j = worker->i + 1; j < nthreads; j += 1)
+			next[a] += g->count[(size_t) j * nthreads + a];
+		k += g->worker[a].arcs;
+	}
+
+	for (i = last - 1; i >= first; i -= 1) {
+		e = &g->e[i];
+		g->bucket[next[id(g, e->u) / chunk]++] = 2 * i;
+		g->bucket[next[id(g, e->v) / chunk]++] = 2 * i + 1;
+	}
+
+	pthread_barrier_wait(&g->start);
+
+	b = 0;
+	for (j = 0; j < worker->i; j += 1)
+		b += g->worker[j].arcs;
+
+	for (i = begin; i < end; i += 1)
+		g->v[i].degree = 0;
+
+	for (k = b; k < b + worker->arcs; k += 1) {
+		e = &g->e[g->bucket[k] / 2];
+		u = g->bucket[k] & 1 ? e->v : e->u;
+		u->degree += 1;
+	}
+
+	/* with one worker there is nobody to share a hub with. */
+
+	k = b;
+	for (i = begin; i < end; i += 1) {
+		u = &g->v[i];
+		u->arc = g->arc + k;
+		k += u->degree;
+		u->hub = hub > 0 && nthreads > 1 && u->degree >= 2 * hub;
+		u->degree = 0;
+	}
+
+	/* the kernels also want the other node and the edge of each arc
+	 * as indices, so that they can gather eight arcs at a time.
+	 *
+	 */
+
+	for (k = b; k < b + worker->arcs; k += 1) {
+		e = &g->e[g->bucket[k] / 2];
+
+		if (g->bucket[k] & 1) {
+			u = e->v;
+			v = e->u;
+		} else {
+			u = e->u;
+			v = e->v;
+		}
+
+		c = u->arc - g->arc + u->degree;
+		u->degree += 1;
+		g->arc[c] = e;
+		g->head[c] = id(g, v);
+		g->side[c] = g->bucket[k];
+	}
+
+	trace_span(worker->trace, "build", span, 0);
+
+	return NULL;
+}
+
+static graph_t* new_graph(FILE* in, int n, int m, int nthreads, trace_t* trace)
+{
+	graph_t*	g;
+	edge_t*		e;
+	double		begin;
+	double		span;
+	pthread_t	thread[nthreads];
+	pthread_attr_t	attr;
+	int		i;
+	int		a;
+	int		b;
+	int		c;
+	int		sourceTotalFlow;
+	int		sinkTotalFlow;
+	
+	g = xmalloc(sizeof(graph_t));
+
+	g->n = n;
+	g->m = m;
+	g->trace = trace;
+	
+	g->v = xcalloc(n, sizeof(node_t));
+	g->e = xcalloc(m, sizeof(edge_t));
+	g->arc = xaligned_alloc(2 * (size_t) m, sizeof(edge_t*));
+	g->head = xaligned_alloc(2 * (size_t) m, sizeof(int));
+	g->side = xaligned_alloc(2 * (size_t) m, sizeof(int));
+	g->count = xaligned_alloc((size_t) nthreads * nthreads, sizeof(long));
+	g->bucket = xaligned_alloc(2 * (size_t) m, sizeof(int));
+	g->delta = xaligned_alloc(n, sizeof(delta_t));
+	g->dist = xaligned_alloc(n, sizeof(int));
+	g->global = 0;
+	g->relabels = 0;
+	g->pushes = 0;
+	g->bfs = 0;
+	g->maxscan = 0;
+	g->sumscan = 0;
+	g->maxwork = 0;
+	g->maxround = 0;
+
+	g->totalJobs = 0;
+	g->nthreads = nthreads;
+
+	g->worker = xaligned_alloc(nthreads, sizeof(worker_t));
+	memset(g->worker, 0, nthreads * sizeof(worker_t));
+#if STATS
+	memset(&g->stat, 0, sizeof g->stat);
+#endif
+	g->hot = CONTENTION ? xcalloc(n, sizeof(hot_t)) : NULL;
+	for (int i = 0; i < nthreads; i += 1) {
+		g->worker[i].i = i;
+		g->worker[i].g = g;
+	}
+
+	/* reading is serial, but the sums of the capacities at nodes 0
+	 * and n-1 are found on the way.
+	 *
+	 */
+
+	begin = timebase_sec();
+	span = trace_time(trace);
+
+	sourceTotalFlow = 0;
+	sinkTotalFlow = 0;
+
+	for (i = 0; i < m; i += 1) {
+		a = next_int();
+		b = next_int();
+		c = next_int();
+		e = &g->e[i];
+		e->u = &g->v[a];
+		e->v = &g->v[b];
+		e->c = c;
+		sourceTotalFlow += (a == 0) * c + (b == 0) * c;
+		sinkTotalFlow += (a == n-1) * c + (b == n-1) * c;
+	}
+
+	g->read = timebase_sec() - begin;
+	trace_span(trace, "parse", span, 0);
+
+	begin = timebase_sec();
+	span = trace_time(trace);
+
+	pthread_barrier_init(&g->start, NULL, nthreads);
+
+	for (i = 0; i < nthreads; i += 1) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, build, &g->worker[i]))
+			error("pthread_create failed");
+		pthread_attr_destroy(&attr);
+	}
+
+	for (i = 0; i < nthreads; i += 1)
+		if (pthread_join(thread[i], NULL) != 0)
+			error("pthread_join failed");
+
+	pthread_barrier_destroy(&g->start);
+	free(g->count);
+	free(g->bucket);
+
+	g->build = timebase_sec() - begin;
+	trace_span(trace, "build", span, 0);
+
+	// switch source and sink here if sounce flow is more than sink flow
+	if (sinkTotalFlow < sourceTotalFlow) {
+		g->s = &g->v[n-1];
+		g->t = &g->v[0];
+	} else {
+		g->s = &g->v[0];
+		g->t = &g->v[n-1];
+	}
+
+
+	return g;
+}
+
+static void relabel(graph_t* g, node_t* u)
+{
+	u->h += 1;
+	g->relabels += 1;
+	//pr("relabel %d now h = %d\n", id(g, u), u->h);
+}
+
+static node_t* other(node_t* u, edge_t* e)
+{
+	if (u == e->u)
+		return e->v;
+	else
+		return e->u;
+}
+
+/* the first arc from k on, and before end, on which u can push, or
+ * end if there is none.
+ *
+ */
+
+static int admissible_scalar(graph_t* g, node_t* u, int k, int end)
+{
+	edge_t*		e;
+
+	for (; k < end; k += 1) {
+		e = u->arc[k];
+
+		if (u == e->u) {
+			if (u->h > e->v->h && e->f < e->c)
+				break;
+		} else if (u->h > e->u->h && -e->f < e->c)
+			break;
+	}
+
+	return k;
+}
+
+/* the lowest height at the other end of an arc of u with residual
+ * capacity, or INT_MAX if there is none.
+ *
+ */
+
+static int min_height_scalar(graph_t* g, node_t* u)
+{
+	edge_t*		e;
+	int		min;
+	int		k;
+
+	min = INT_MAX;
+
+	for (k = 0; k < u->degree; k += 1) {
+		e = u->arc[k];
+
+		if (u == e->u) {
+			if (e->f < e->c && e->v->h < min)
+				min = e->v->h;
+		} else if (-e->f < e->c && e->u->h < min)
+			min = e->u->h;
+	}
+
+	return min;
+}
+
+#ifdef __x86_64__
+
+/* the avx2 kernels load eight arcs of u from g->head and g->side and
+ * gather the heights of their other nodes, and the flows and
+ * capacities of their edges, with the node and edge sizes as strides.
+ * the flow is negated for arcs from e->v with a sign instruction.
+ *
+ * a discharge calls the search again from the arc after each push,
+ * so the rest of a block of eight is looked at one arc at a time.
+ * otherwise a run of admissible arcs would gather each block again
+ * for every push.
+ *
+ */
+
+__attribute__((target("avx2")))
+static int admissible_avx2(graph_t* g, node_t* u, int k, int end)
+{
+	const int*	head = g->head + (u->arc - g->arc);
+	const int*	side = g->side + (u->arc - g->arc);
+	const __m256i	nsize = _mm256_set1_epi32(sizeof(node_t) / sizeof(int));
+	const __m256i	esize = _mm256_set1_epi32(sizeof(edge_t) / sizeof(int));
+	const __m256i	one = _mm256_set1_epi32(1);
+	const __m256i	hu = _mm256_set1_epi32(u->h);
+	__m256i		h;
+	__m256i		x;
+	__m256i		b;
+	__m256i		f;
+	__m256i		c;
+	__m256i		lower;
+	int		mask;
+	int		next;
+
+	next = MIN((k + 7) & ~7, end);
+	k = admissible_scalar(g, u, k, next);
+	if (k < next)
+		return k;
+
+	for (; k + 8 <= end; k += 8) {
+		x = _mm256_loadu_si256((const __m256i*) &head[k]);
+		h = _mm256_i32gather_epi32(&g->v->h, _mm256_mullo_epi32(x, nsize), 4);
+		lower = _mm256_cmpgt_epi32(hu, h);
+
+		/* most arcs lead up or level, so look at no edge then. */
+
+		if (_mm256_testz_si256(lower, lower))
+			continue;
+
+		x = _mm256_loadu_si256((const __m256i*) &side[k]);
+		b = _mm256_sub_epi32(one, _mm256_slli_epi32(_mm256_and_si256(x, one), 1));
+		x = _mm256_mullo_epi32(_mm256_srli_epi32(x, 1), esize);
+		f = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), &g->e->f, x, lower, 4);
+		c = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), &g->e->c, x, lower, 4);
+		f = _mm256_sign_epi32(f, b);
+
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+			_mm256_and_si256(lower, _mm256_cmpgt_epi32(c, f))));
+
+		if (mask != 0)
+			return k + __builtin_ctz(mask);
+	}
+
+	return admissible_scalar(g, u, k, end);
+}
+
+__attribute__((target("avx2")))
+static int min_height_avx2(graph_t* g, node_t* u)
+{
+	const int*	head = g->head + (u->arc - g->arc);
+	const int*	side = g->side + (u->arc - g->arc);
+	const __m256i	nsize = _mm256_set1_epi32(sizeof(node_t) / sizeof(int));
+	const __m256i	esize = _mm256_set1_epi32(sizeof(edge_t) / sizeof(int));
+	const __m256i	one = _mm256_set1_epi32(1);
+	const __m256i	none = _mm256_set1_epi32(INT_MAX);
+	__m256i		min;
+	__m256i		h;
+	__m256i		x;
+	__m256i		b;
+	__m256i		f;
+	__m256i		c;
+	__m128i		y;
+	edge_t*		e;
+	int		k;
+	int		m;
+
+	min = none;
+
+	for (k = 0; k + 8 <= u->degree; k += 8) {
+		x = _mm256_loadu_si256((const __m256i*) &head[k]);
+		h = _mm256_i32gather_epi32(&g->v->h, _mm256_mullo_epi32(x, nsize), 4);
+
+		x = _mm256_loadu_si256((const __m256i*) &side[k]);
+		b = _mm256_sub_epi32(one, _mm256_slli_epi32(_mm256_and_si256(x, one), 1));
+		x = _mm256_mullo_epi32(_mm256_srli_epi32(x, 1), esize);
+		f = _mm256_sign_epi32(_mm256_i32gather_epi32(&g->e->f, x, 4), b);
+		c = _mm256_i32gather_epi32(&g->e->c, x, 4);
+
+		h = _mm256_blendv_epi8(none, h, _mm256_cmpgt_epi32(c, f));
+		min = _mm256_min_epi32(min, h);
+	}
+
+	y = _mm_min_epi32(_mm256_castsi256_si128(min), _mm256_extracti128_si256(min, 1));
+	y = _mm_min_epi32(y, _mm_shuffle_epi32(y, _MM_SHUFFLE(1, 0, 3, 2)));
+	y = _mm_min_epi32(y, _mm_shuffle_epi32(y, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm_cvtsi128_si32(y);
+
+	for (; k < u->degree; k += 1) {
+		e = u->arc[k];
+
+		if (u == e->u) {
+			if (e->f < e->c && e->v->h < m)
+				m = e->v->h;
+		} else if (-e->f < e->c && e->u->h < m)
+			m = e->u->h;
+	}
+
+	return m;
+}
+
+#endif
+
+static int (*admissible)(graph_t* g, node_t* u, int k, int end) = admissible_scalar;
+static int (*min_height)(graph_t* g, node_t* u) = min_height_scalar;
+
+static const char* select_kernel(void)
+{
+#ifdef __x86_64__
+	if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("avx2")) {
+		admissible = admissible_avx2;
+		min_height = min_height_avx2;
+		return "avx2";
+	}
+#endif
+
+	if (kernel == KERNEL_AVX2)
+		error("this cpu cannot run the avx2 kernels");
+
+	return "scalar";
+}
+
+static int getNextThreadIndex(graph_t* g, node_t* u)
+{
+	int index = g->totalJobs % g->nthreads;
+	g->totalJobs += 1;
+
+	/* a worker is as late as the arcs it must scan, so give u to
+	 * the one with the fewest so far this round. ties go round robin.
+	 *
+	 */
+
+	if (balance == BALANCE_DEGREE) {
+		for (int i = 0; i < g->nthreads; i += 1)
+			if (g->worker[i].load < g->worker[index].load)
+				index = i;
+
+		g->worker[index].load += u->degree + 1;
+	}
+
+	return index;
+}
+
+static void account_round(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	long		sum;
+	int		i;
+
+	/* all workers wait so their counts for the round are final. */
+
+	max = 0;
+	sum = 0;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		w->total += w->scanned;
+		sum += w->scanned;
+		if (w->scanned > max)
+			max = w->scanned;
+		w->scanned = 0;
+		w->load = 0;
+	}
+
+	g->maxscan += max;
+	g->sumscan += sum;
+}
+
+static void account_work(graph_t* g, int round)
+{
+	size_t		work;
+	int		i;
+
+	/* the active nodes are in lists through the nodes themselves, so
+	 * the work given out for a round which takes memory of its own is
+	 * the slices of the hubs.
+	 *
+	 */
+
+	work = 0;
+
+	for (i = 0; i < g->nthreads; i += 1)
+		work += g->worker[i].nslice * sizeof(slice_t);
+
+	if (work > g->maxwork) {
+		g->maxwork = work;
+		g->maxround = round;
+	}
+}
+
+static void report_memory(graph_t* g)
+{
+	size_t		nodes;
+	size_t		edges;
+	size_t		arcs;
+	size_t		deltas;
+	size_t		workers;
+	size_t		hot;
+
+	/* what the graph takes with -v. the arcs are the arc pointers and
+	 * the heads and sides next to them, two of each per edge. the
+	 * counts and buckets of the build are freed before preflow starts.
+	 *
+	 */
+
+	nodes = g->n * sizeof(node_t);
+	edges = g->m * sizeof(edge_t);
+	arcs = 2 * (size_t) g->m * (sizeof(edge_t*) + 2 * sizeof(int));
+	deltas = g->n * (sizeof(delta_t) + sizeof(int));
+	workers = g->nthreads * sizeof(worker_t);
+	hot = g->hot != NULL ? g->n * sizeof(hot_t) : 0;
+
+	memory_print("nodes", nodes, g->n, g->m);
+	memory_print("edges", edges, g->n, g->m);
+	memory_print("arcs", arcs, g->n, g->m);
+	memory_print("deltas", deltas, g->n, g->m);
+	memory_print("workers", workers, g->n, g->m);
+	if (hot > 0)
+		memory_print("contention", hot, g->n, g->m);
+	memory_print("graph", sizeof(graph_t) + nodes + edges + arcs + deltas + workers + hot,
+		g->n, g->m);
+	memory_print("build_buckets", (size_t) g->nthreads * g->nthreads * sizeof(long)
+		+ 2 * (size_t) g->m * sizeof(int), g->n, g->m);
+}
+
+static void report_work_memory(graph_t* g)
+{
+	worker_t*	w;
+	size_t		size;
+	int		i;
+
+	/* the slices and the frontiers of the global relabel only grow,
+	 * so what they have now is the most they ever had.
+	 *
+	 */
+
+	size = 0;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		size += w->maxslice * sizeof(slice_t);
+		size += (w->maxcur + w->maxnext) * sizeof(node_t*);
+	}
+
+	memory_print("work_peak", g->maxwork, g->n, g->m);
+	memory_print("work_buffers", size, g->n, g->m);
+
+	if (phase_verbose)
+		fprintf(stderr, "memory work_peak_round: %d\n", g->maxround);
+}
+
+static void report_work(graph_t* g)
+{
+	worker_t*	w;
+	long		max;
+	int		i;
+	int		k;
+
+	/* with -v, a histogram of the arcs each worker scanned, and how much
+	 * longer the rounds took than with a perfect balance, which is
+	 * the largest work of each round summed, against the mean.
+	 *
+	 */
+
+	if (!phase_verbose)
+		return;
+
+	max = 1;
+	for (i = 0; i < g->nthreads; i += 1)
+		if (g->worker[i].total > max)
+			max = g->worker[i].total;
+
+	fprintf(stderr, "arcs scanned per worker, %s assignment:\n",
+		balance == BALANCE_DEGREE ? "degree" : "round robin");
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		fprintf(stderr, "%4d %10ld ", i, w->total);
+		for (k = 0; k < 50 * w->total / max; k += 1)
+			fputc('#', stderr);
+		fputc('\n', stderr);
+	}
+
+	fprintf(stderr, "round imbalance (largest / mean): %.2f\n",
+		g->sumscan == 0 ? 1.0 : (double) g->nthreads * g->maxscan / g->sumscan);
+}
+
+#if STATS
+static void report_stats(graph_t* g, int round, int nglobal)
+{
+	worker_t*	w;
+	long		saturating;
+	long		discharges;
+	long		scans;
+	int		i;
+
+	/* g->pushes has the pushes of the workers added already. */
+
+	saturating = g->stat.saturating;
+	discharges = g->stat.discharges;
+	scans = g->stat.scans;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		w = &g->worker[i];
+		saturating += w->stat.saturating;
+		discharges += w->stat.discharges;
+		scans += w->total;
+	}
+
+	fprintf(stderr, "stat rounds: %d\n", round);
+	fprintf(stderr, "stat discharges: %ld\n", discharges);
+	fprintf(stderr, "stat pushes: %ld\n", g->pushes);
+	fprintf(stderr, "stat saturating: %ld\n", saturating);
+	fprintf(stderr, "stat nonsaturating: %ld\n", g->pushes - saturating);
+	fprintf(stderr, "stat relabels: %ld\n", g->relabels);
+	fprintf(stderr, "stat global_relabels: %d\n", nglobal);
+	fprintf(stderr, "stat arcs_scanned: %ld\n", scans);
+	fprintf(stderr, "stat idle_main: %.3f ms\n", g->stat.idle * 1e3);
+
+	for (i = 0; i < g->nthreads; i += 1)
+		fprintf(stderr, "stat idle_%d: %.3f ms\n", i, g->worker[i].stat.idle * 1e3);
+}
+#endif
+
+#if CONTENTION
+static int hotter(const void* a, const void* b)
+{
+	const hot_t*	x = *(const hot_t**) a;
+	const hot_t*	y = *(const hot_t**) b;
+
+	return x->wait < y->wait ? 1 : x->wait > y->wait ? -1 : 0;
+}
+#endif
+
+static void report_contention(graph_t* g)
+{
+#if CONTENTION
+	contention_t*	c;
+	hot_t**		hot;
+	node_t*		u;
+	int		nhot;
+	int		i;
+	int		k;
+
+	/* the atomics of each worker, and then the nodes with the longest
+	 * sampled waits, which are the ones to keep within one worker.
+	 *
+	 */
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		c = &g->worker[i].contention;
+		fprintf(stderr, "contention worker %d: %ld adds, %ld timed in %.3f ms, "
+			"%ld swaps, %ld retries, %.3f ms\n", i, c->adds, c->timed, c->add * 1e3,
+			c->swaps, c->retries, c->wait * 1e3);
+	}
+
+	hot = xmalloc(g->n * sizeof(hot_t*));
+	nhot = 0;
+
+	for (i = 0; i < g->n; i += 1)
+		if (g->hot[i].samples > 0)
+			hot[nhot++] = &g->hot[i];
+
+	qsort(hot, nhot, sizeof hot[0], hotter);
+
+	fprintf(stderr, "contention top %d of %d nodes, 1 in %d adds timed:\n",
+		MIN(TOP, nhot), nhot, SAMPLE);
+
+	for (k = 0; k < TOP && k < nhot; k += 1) {
+		i = hot[k] - g->hot;
+		u = &g->v[i];
+		fprintf(stderr, "contention node %d: degree %d%s, %ld samples, "
+			"%ld retries, %.3f ms\n", i, u->degree, u->hub ? " hub" : "",
+			(long) hot[k]->samples, (long) hot[k]->retries, hot[k]->wait * 1e-6);
+	}
+
+	free(hot);
+#else
+	(void) g;
+#endif
+}
+
+static void add_slice(worker_t* worker, node_t* u, int begin, int end, int budget)
+{
+	slice_t*	slice;
+
+	if (worker->nslice == worker->maxslice) {
+		worker->maxslice = worker->maxslice == 0 ? 16 : 2 * worker->maxslice;
+		worker->slice = xrealloc(worker->slice, worker->maxslice * sizeof(slice_t));
+	}
+
+	slice = &worker->slice[worker->nslice++];
+	slice->u = u;
+	slice->begin = begin;
+	slice->end = end;
+	slice->budget = budget;
+	worker->load += end - begin + 1;
+}
+
+static void split_hub(graph_t* g, node_t* u)
+{
+	char		used[g->nthreads];
+	int		k;
+	int		i;
+	int		j;
+	int		index;
+
+	/* u is one active node but its k slices go to k different
+	 * workers, the least loaded ones with degree balance, which
+	 * together may push at most the excess u has now.
+	 *
+	 */
+
+	k = MIN(g->nthreads, u->degree / hub);
+
+	/* with -d slice j may push the excess between j * e / k and
+	 * (j + 1) * e / k, and there are no more slices than units of
+	 * excess so that each can push along any admissible arc it has.
+	 * u is relabeled only if none has one, and what the slices could
+	 * not push is shared out again in the next round.
+	 *
+	 */
+
+	if (deterministic)
+		k = MIN(k, u->e);
+
+	u->avail = u->e;
+	u->slices = k;
+	u->pushed = 0;
+
+	memset(used, 0, sizeof used);
+
+	for (j = 0; j < k; j += 1) {
+		index = (g->totalJobs + j) % g->nthreads;
+
+		if (balance == BALANCE_DEGREE) {
+			for (i = 0; i < g->nthreads; i += 1)
+				if (!used[i] && (used[index]
+					|| g->worker[i].load < g->worker[index].load))
+					index = i;
+		}
+
+		used[index] = 1;
+		add_slice(&g->worker[index], u,
+			(long) j * u->degree / k, (long) (j + 1) * u->degree / k,
+			(long) (j + 1) * u->e / k - (long) j * u->e / k);
+	}
+
+	g->totalJobs += 1;
+}
+
+static void allocateNodeToThread(graph_t* g, node_t* u)
+{
+	if (u != g->s && u != g->t && u->in_queue == 0) {
+		u->in_queue = 1;
+
+		if (u->hub) {
+			split_hub(g, u);
+			return;
+		}
+
+		int index = getNextThreadIndex(g, u);
+		worker_t* worker = &g->worker[index];
+		u->next = worker->excess;
+		worker->excess = u;
+		//pr("added node %d with excess %d to thread %d\n", id(g, u),u->e, index);
+	} else {
+		//pr("skipping adding s or t to excess list\n");
+	}
+}
+
+static int discharge_sequential(graph_t* g, node_t* excess, int active, int limit)
+{
+	node_t*		s = g->s;
+	node_t*		t = g->t;
+	node_t*		u;
+	node_t*		v;
+	edge_t*		e;
+	int		i;
+	int		b;
+	int		h;
+	int		df;
+
+	/* discharge the active nodes on this thread, as in lab 0, while
+	 * the workers wait for the next round. it stops when no node has
+	 * excess or when more than limit nodes have, and then gives the
+	 * nodes left to the workers. returns how many that was.
+	 *
+	 */
+
+	while ((u = excess) != NULL && active <= limit) {
+		excess = u->next;
+		u->next = NULL;
+		active -= 1;
+		stat_add(&g->stat, discharges, 1);
+
+		for (i = 0; u->e > 0 && (i = admissible(g, u, i, u->degree)) < u->degree; i += 1) {
+			e = u->arc[i];
+
+			if (u == e->u) {
+				v = e->v;
+				b = 1;
+			} else {
+				v = e->u;
+				b = -1;
+			}
+
+			df = MIN(u->e, e->c - b * e->f);
+			u->e -= df;
+			v->e += df;
+			e->f += b * df;
+			g->pushes += 1;
+			stat_add(&g->stat, saturating, b * e->f == e->c);
+
+			if (v != s && v != t && v->in_queue == 0) {
+				v->in_queue = 1;
+				v->next = excess;
+				excess = v;
+				active += 1;
+			}
+		}
+
+		stat_add(&g->stat, scans, i);
+
+		/* nothing else moves now, so u can be lifted straight to
+		 * one above its lowest residual neighbor.
+		 *
+		 */
+
+		if (u->e > 0) {
+			stat_add(&g->stat, scans, u->degree);
+			h = min_height(g, u);
+			relabel(g, u);
+			if (h != INT_MAX && h + 1 > u->h)
+				u->h = h + 1;
+			u->next = excess;
+			excess = u;
+			active += 1;
+		} else
+			u->in_queue = 0;
+	}
+
+	while ((u = excess) != NULL) {
+		excess = u->next;
+		u->in_queue = 0;
+		allocateNodeToThread(g, u);
+	}
+
+	return active;
+}
+
+static void clear_delta(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+	int		begin;
+	int		end;
+
+	/* each worker zeroes its range of the delta array so that its
+	 * pages are first touched, and thus placed, by that worker.
+	 *
+	 */
+
+	node_range(worker, &begin, &end);
+
+	memset(&g->delta[begin], 0, (end - begin) * sizeof(delta_t));
+
+	for (; begin < end; begin += 1)
+		g->dist[begin] = -1;
 }
 
-static int next_int()
+static void bfs_add(worker_t* worker, node_t* u)
 {
-        int     x;
-        int     c;
-
-	x = 0;
-        while (isdigit(c = getchar()))
-                x = 10 * x + c - '0';
+	if (worker->nnext == worker->maxnext) {
+		worker->maxnext = worker->maxnext == 0 ? 64 : 2 * worker->maxnext;
+		worker->next = xrealloc(worker->next, worker->maxnext * sizeof(node_t*));
+	}
 
-        return x;
+	worker->next[worker->nnext++] = u;
 }
 
-static void* xmalloc(size_t s)
+static void swap_frontier(worker_t* worker)
 {
-	void*		p;
+	node_t**	p;
+	int		max;
 
-	p = malloc(s);
+	p = worker->cur;
+	max = worker->maxcur;
 
-	if (p == NULL)
-		error("out of memory: malloc(%zu) failed", s);
+	worker->cur = worker->next;
+	worker->ncur = worker->nnext;
+	worker->maxcur = worker->maxnext;
 
-	return p;
+	worker->next = p;
+	worker->nnext = 0;
+	worker->maxnext = max;
 }
 
-static void* xcalloc(size_t n, size_t s)
+static void scan(worker_t* worker, node_t* u, int d)
 {
-	void*		p;
+	graph_t*	g = worker->g;
+	node_t*		v;
+	edge_t*		e;
+	int		expected;
+	int		i;
 
-	p = xmalloc(n * s);
+	/* find the nodes which can push to u and are not yet found.
+	 * in dense graphs all are found long before every arc has been
+	 * looked at, so stop then.
+	 *
+	 */
 
-	memset(p, 0, n * s);
+	for (i = 0; i < u->degree; i += 1) {
+		if (atomic_load_explicit(&g->found, memory_order_relaxed) == g->n - 1)
+			return;
 
+		e = u->arc[i];
 
-	return p;
+		if (u == e->u) {
+			v = e->v;
+			if (-e->f == e->c)
+				continue;
+		} else {
+			v = e->u;
+			if (e->f == e->c)
+				continue;
+		}
+
+		if (v == g->s)
+			continue;
+
+		/* most nodes are already found, so look before the cas. */
+
+		if (atomic_load_explicit(&g->dist[id(g, v)], memory_order_relaxed) >= 0)
+			continue;
+
+		expected = -1;
+		if (atomic_compare_exchange_strong(&g->dist[id(g, v)], &expected, d)) {
+			atomic_fetch_add_explicit(&g->found, 1, memory_order_relaxed);
+			bfs_add(worker, v);
+		}
+	}
 }
 
-static void mutex_lock(pthread_mutex_t* m, const char* name)
+static void global_relabel(worker_t* worker)
 {
-	/* lock a mutex and check that it was successful.
-	 *
-	 * the pthread_mutex_lock function returns 0 if the lock
-	 * was successful and otherwise an error code.
+	graph_t*	g = worker->g;
+	worker_t*	w;
+	node_t*		u;
+	int		nthreads = g->nthreads;
+	int		level;
+	int		total;
+	int		begin;
+	int		end;
+	int		chunk;
+	int		i;
+	int		j;
+	int		k;
+	int		d;
+
+	/* set every height to the distance to the sink in the residual
+	 * graph with a backward breadth first search. each level is
+	 * scanned by all workers, each taking its share of what all
+	 * workers found in the level before, and new nodes go into the
+	 * next frontier of the worker that found them.
 	 *
 	 */
-	// pr("locking mutex %s\n", name);
-	if (pthread_mutex_lock(m) != 0)
-		error("mutex lock failed");
 
-}
+	if (worker->i == 0) {
+		g->found = 1;
+		g->dist[id(g, g->t)] = 0;
+		bfs_add(worker, g->t);
+	}
 
-static void add_edge(node_t* u, edge_t* e)
-{
-	list_t*		p;
+	for (level = 0; ; level += 1) {
+		swap_frontier(worker);
+		wait_start(worker);
+
+		total = 0;
+		for (j = 0; j < nthreads; j += 1)
+			total += g->worker[j].ncur;
+
+		if (total == 0)
+			break;
+
+		begin = (long) worker->i * total / nthreads;
+		end = (long) (worker->i + 1) * total / nthreads;
+
+		k = 0;
+		for (j = 0; j < nthreads && k < end; j += 1) {
+			w = &g->worker[j];
+			for (i = 0; i < w->ncur && k < end; i += 1, k += 1)
+				if (k >= begin)
+					scan(worker, w->cur[i], level + 1);
+		}
+
+		/* nobody swaps its frontier until all have read it. */
 
-	/* allocate memory for a list link and put it first
-	 * in the adjacency list of u.
+		wait_start(worker);
+	}
+
+	/* nodes which cannot reach the sink must send their excess back
+	 * to the source and get at least its height. heights are never
+	 * lowered since they are lower bounds of the distance.
 	 *
 	 */
 
-	p = xmalloc(sizeof(list_t));
-	p->edge = e;
-	p->next = u->edge;
-	u->edge = p;
+	chunk = (g->n + nthreads - 1) / nthreads;
+	begin = MIN(worker->i * chunk, g->n);
+	end = MIN(begin + chunk, g->n);
+
+	for (i = begin; i < end; i += 1) {
+		u = &g->v[i];
+		d = g->dist[i];
+		g->dist[i] = -1;
+
+		if (u == g->s || u == g->t)
+			continue;
+
+		if (d < 0)
+			d = g->n;
+
+		if (d > u->h)
+			u->h = d;
+	}
+
+	wait_start(worker);
 }
 
-static void connect(node_t* u, node_t* v, int c, edge_t* e)
+static void discharge_slice(worker_t* worker, slice_t* slice)
 {
-	/* connect two nodes by putting a shared (same object)
-	 * in their adjacency lists.
+	graph_t*	g = worker->g;
+	node_t*		u = slice->u;
+	node_t*		v;
+	edge_t*		e;
+	int		pushed;
+	int		have;
+	int		df;
+	int		b;
+	int		i;
+
+	/* push along our arcs of the hub u. the excess is taken from
+	 * u->avail so that the workers together never push more than u
+	 * had, or with -d from the budget of the slice, and what is left
+	 * of it is given back to u->avail at the end. no other worker
+	 * pushes along these arcs since the nodes at their other ends are
+	 * lower than u. the last worker to finish a slice relabels u if
+	 * no slice could push at all.
 	 *
 	 */
 
-	e->u = u;
-	e->v = v;
-	e->c = c;
+	pushed = 0;
+	i = slice->begin;
+	have = slice->budget;
+
+	while (u->h > 0 && (i = admissible(g, u, i, slice->end)) < slice->end) {
+		if (!deterministic)
+			have = atomic_load_explicit(&u->avail, memory_order_relaxed);
+
+		if (have == 0)
+			break;
+
+		e = u->arc[i];
+		i += 1;
+
+		if (u == e->u) {
+			v = e->v;
+			b = 1;
+		} else {
+			v = e->u;
+			b = -1;
+		}
+
+		if (deterministic) {
+			df = MIN(have, e->c - b * e->f);
+			have -= df;
+		} else {
+			df = take_avail(worker, u, &have, e->c - b * e->f);
+		}
+
+		if (df == 0)
+			break;
+
+		add_delta(worker, v, df);
+		add_delta(worker, u, -df);
+		e->f += b * df;
+		worker->pushes += 1;
+		stat_add(&worker->stat, saturating, b * e->f == e->c);
+		pushed = 1;
+	}
+
+	stat_add(&worker->stat, discharges, slice->begin == 0);
 
-	add_edge(u, e);
-	add_edge(v, e);
+	worker->scanned += i - slice->begin;
+
+	if (deterministic)
+		atomic_fetch_sub(&u->avail, slice->budget - have);
+
+	if (pushed)
+		atomic_store_explicit(&u->pushed, 1, memory_order_relaxed);
+
+	if (atomic_fetch_sub(&u->slices, 1) == 1) {
+		if (!u->pushed && u->avail > 0)
+			g->delta[id(g, u)].relabel = 1;
+		u->in_queue = 0;
+	}
 }
 
-static graph_t* new_graph(FILE* in, int n, int m, int nthreads)
+static void saturate(worker_t* worker)
 {
-	graph_t*	g;
+	graph_t*	g = worker->g;
+	node_t*		s = g->s;
 	node_t*		u;
 	node_t*		v;
+	edge_t*		e;
+	delta_t*	d;
+	int		begin;
+	int		end;
 	int		i;
-	int		a;
-	int		b;
-	int		c;
-	
-	g = xmalloc(sizeof(graph_t));
 
-	g->n = n;
-	g->m = m;
-	
-	g->v = xcalloc(n, sizeof(node_t));
-	g->e = xcalloc(m, sizeof(edge_t));
+	/* start by pushing as much as possible (limited by the edge
+	 * capacity) from the source to its neighbors. each worker takes
+	 * its share of the arcs of s and adds to the deltas, and then
+	 * moves the deltas of its own nodes to their excess and puts the
+	 * ones with excess in its own list. a hub is not split in the
+	 * first round since its slices would go to the other workers.
+	 *
+	 */
 
-	g->totalJobs = 0;
-	g->nthreads = nthreads;
+	begin = (long) worker->i * s->degree / g->nthreads;
+	end = (long) (worker->i + 1) * s->degree / g->nthreads;
 
-	g->worker = xcalloc(nthreads, sizeof(worker_t));
-	for (int i = 0; i < nthreads; i += 1) {
-		g->worker[i].i = i;
-		g->worker[i].g = g;
-	}
+	for (i = begin; i < end; i += 1) {
+		e = s->arc[i];
+		v = other(s, e);
 
-	for (i = 0; i < m; i += 1) {
-		a = next_int();
-		b = next_int();
-		c = next_int();
-		u = &g->v[a];
-		v = &g->v[b];
-		connect(u, v, c, &g->e[i]);
-	}
+		if (v == s)
+			continue;
 
-	// switch source and sink here if sounce flow is more than sink flow
-	list_t * p = g->v[0].edge;
-	int sourceTotalFlow = 0;
-	while (p != NULL) {
-		sourceTotalFlow += p->edge->c;
-		p = p->next;
+		e->f += s == e->u ? e->c : -e->c;
+		add_delta(worker, v, e->c);
+		add_delta(worker, s, -e->c);
 	}
 
-	list_t* q = g->v[n-1].edge;
-	int sinkTotalFlow = 0;
-	while (q != NULL) {
-		sinkTotalFlow += q->edge->c;
-		//pr("%d", sinkTotalFlow);
-		q = q->next;
-	}
+	wait_start(worker);
 
-	if (sinkTotalFlow < sourceTotalFlow) {
-		g->s = &g->v[n-1];
-		g->t = &g->v[0];
-	} else {
-		g->s = &g->v[0];
-		g->t = &g->v[n-1];
-	}
+	node_range(worker, &begin, &end);
 
+	for (i = begin; i < end; i += 1) {
+		d = &g->delta[i];
+		if (d->e == 0)
+			continue;
 
-	return g;
-}
+		u = &g->v[i];
+		u->e += d->e;
+		d->e = 0;
 
-static void relabel(graph_t* g, node_t* u)
-{
-	u->h += 1;
-	//pr("relabel %d now h = %d\n", id(g, u), u->h);
-}
+		if (u != s && u != g->t) {
+			u->in_queue = 1;
+			u->next = worker->excess;
+			worker->excess = u;
+		}
+	}
 
-static node_t* other(node_t* u, edge_t* e)
-{
-	if (u == e->u)
-		return e->v;
-	else
-		return e->u;
-}
+	/* nobody may push to our nodes before we have read their deltas. */
 
-static int getNextThreadIndex(graph_t* g)
-{
-	int index = g->totalJobs % g->nthreads;
-	g->totalJobs += 1;
-	return index;
-}
+	wait_start(worker);
 
-static void allocateNodeToThread(graph_t* g, node_t* u)
-{
-	if (u != g->s && u != g->t && u->in_queue == 0) {
-		u->in_queue = 1;
-		int index = getNextThreadIndex(g);
-		worker_t* worker = &g->worker[index];
-		u->next = worker->excess;
-		worker->excess = u;
-		//pr("added node %d with excess %d to thread %d\n", id(g, u),u->e, index);
-	} else {
-		//pr("skipping adding s or t to excess list\n");
-	}
+	if (worker->i == 0)
+		g->first = timebase_sec() - g->begin;
 }
 
 static void *work(void* args)
@@ -335,22 +2064,54 @@ static void *work(void* args)
 	node_t* v = NULL;
 	edge_t* e = NULL;
 	graph_t* g = worker->g;
-	list_t* p;
+	int		k;
 	int		b;
 	int 	df;
 	int 	u_e; 
+	int		relabel_all;
+	double		idle;
+	double		span;
+	long		round;
+	char		name[32];
+	double		begin;
+
+	snprintf(name, sizeof name, "worker %d", worker->i);
+	worker->trace = trace_thread(worker->i + 1, name);
+	span = trace_time(worker->trace);
+
+	clear_delta(worker);
+	wait_start(worker);
+
+	saturate(worker);
+
+	trace_span(worker->trace, "saturate", span, 0);
+
+	for (round = 1; ; round += 1) {
+		span = trace_time(worker->trace);
 
-	while (1) {
 		node_t* u = worker->excess;
 		while (u != NULL) {
 			u_e = u->e; //excess flow of u
-			p = u->edge;
+			k = 0;
 			int pushed = 0;
 
 			//1. check if push is possible
-			while (p != NULL && u_e > 0) {
-				e = p->edge;
-				p = p->next;
+			while (k < u->degree && u_e > 0) {
+				if (u->h == 0) {
+					//do reabel
+					//pr("create relabel work for node @%d\n", id(g, u));
+					// create relabel work
+					g->delta[id(g, u)].relabel = 1;
+					pushed = 1;
+					break;
+				}
+
+				k = admissible(g, u, k, u->degree);
+				if (k == u->degree)
+					break;
+
+				e = u->arc[k];
+				k += 1;
 
 				if (u == e->u) {
 					v = e->v;
@@ -360,39 +2121,32 @@ static void *work(void* args)
 					b = -1;
 				}
 
-				//pr("@T%d: looking at next edge %d -> %d, u_e = %d\n", worker->i, id(g, u), id(g, v), u_e);
+				//pr("@T%d: pushing on edge %d -> %d, u_e = %d\n", worker->i, id(g, u), id(g, v), u_e);
 
-				if (u->h == 0) {
-					//do reabel
-					//pr("create relabel work for node @%d\n", id(g, u));
-					// create relabel work
-					relabels[id(g,u)] = 1;
-					pushed = 1;
-					break;
-				}
-				// print if statement
-				//pr("@T%d: chckecking if: u->h = %d > v->h = %d && abs(u_e) = %d > 0 && b * e->f = %d < e->c = %d\n", worker->i, u->h, v->h, abs(u_e), b*e->f, e->c);
-				if (u->h > v->h && abs(u_e) > 0 && b * e->f < e->c) {
-					if (b ==  1) {
-						df = MIN(u_e, e->c - e->f);
-					} else {
-						df = -MIN(u_e, e->c + e->f); //This flow must be negative
-					}
-					u_e -= abs(df);
-					// Create push work
-					atomic_fetch_add_explicit(&delta_excess[id(g, v)], abs(df), memory_order_relaxed);
-					atomic_fetch_add_explicit(&delta_excess[id(g, u)], -abs(df), memory_order_relaxed);
-					e->f += df;
-					//pr("@T%d: create push work from node @%d to node @%d, df = %d\n", worker->i, id(g, u), id(g, v), df);
-					pushed = 1;
+				if (b ==  1) {
+					df = MIN(u_e, e->c - e->f);
+				} else {
+					df = -MIN(u_e, e->c + e->f); //This flow must be negative
 				}
+				u_e -= abs(df);
+				// Create push work
+				add_delta(worker, v, abs(df));
+				add_delta(worker, u, -abs(df));
+				e->f += df;
+				//pr("@T%d: create push work from node @%d to node @%d, df = %d\n", worker->i, id(g, u), id(g, v), df);
+				worker->pushes += 1;
+				stat_add(&worker->stat, saturating, b * e->f == e->c);
+				pushed = 1;
 			}
 
+			worker->scanned += k;
+			stat_add(&worker->stat, discharges, 1);
+
 
 			//2. if not pushed, reabel
 			if (!pushed && u_e> 0) {
 				//pr("@T%d: no push possible, relabel node @%d\n", worker->i, id(g, u));
-				relabels[id(g, u)] = 1;
+				g->delta[id(g, u)].relabel = 1;
 			}
 			node_t* temp = u;
 			u = u->next;
@@ -402,6 +2156,22 @@ static void *work(void* args)
 
 		worker->excess = NULL;
 
+		trace_span(worker->trace, "discharge", span, round);
+
+		if (worker->nslice > 0) {
+			span = trace_time(worker->trace);
+
+			for (int i = 0; i < worker->nslice; i += 1)
+				discharge_slice(worker, &worker->slice[i]);
+
+			trace_span(worker->trace, "slices", span, round);
+		}
+
+		worker->nslice = 0;
+
+		idle = stat_time();
+		span = trace_time(worker->trace);
+
 		pthread_mutex_lock(&mutex);
 		waitingWorkers++;
 
@@ -413,10 +2183,28 @@ static void *work(void* args)
 
 		if (allDone) {
 			pthread_mutex_unlock(&mutex);
+			stat_add(&worker->stat, idle, stat_time() - idle);
+			trace_span(worker->trace, "handshake", span, round);
 			return 0;
 		}
 
+		relabel_all = g->global;
+
 		pthread_mutex_unlock(&mutex);
+
+		stat_add(&worker->stat, idle, stat_time() - idle);
+		trace_span(worker->trace, "handshake", span, round);
+
+		if (relabel_all) {
+			begin = timebase_sec();
+
+			span = trace_time(worker->trace);
+			global_relabel(worker);
+			trace_span(worker->trace, "global relabel", span, round);
+
+			if (worker->i == 0)
+				g->bfs += timebase_sec() - begin;
+		}
 	}
 }
 	
@@ -425,11 +2213,20 @@ int preflow(graph_t* g)
 	node_t*		s;
 	node_t*		t;
 	node_t*		u;
-	node_t*		v;
-	edge_t*		e;
-	list_t*		p;
+
+	node_t*		excess;
+	int		round;
+	int		jobs;
+	int		active;
+	int		nglobal;
+	long		last;
+	double		idle;
+	double		span;
+	trace_t*	trace;
 
 	int nthreads = g->nthreads;
+
+	trace = g->trace;
 	
 	s = g->s;
 	t = g->t;
@@ -437,73 +2234,106 @@ int preflow(graph_t* g)
 	// Set source height
 	s->h = g->n;
 
-	// Set pointer to first source edge
-	p = s->edge;
+	/* the workers saturate the arcs of s before the first round. */
 
-	/* start by pushing as much as possible (limited by
-	 * the edge capacity) from the source to its neighbors.
-	 *
-	 */
 	pthread_t thread[nthreads];
+	pthread_attr_t	attr;
 
-	int totalPushed = 0;
-	int first = 1;
-	while (p != NULL) {
-		e = p->edge;
-		p = p->next;
-		
-		int df;
-		if (s == e->u) {
-			df = e->c;
-		} else {
-			df = -e->c;
-		}
-
-		node_t* v = other(s, e);
-		//pr("push from %d to %d: ", id(g, s), id(g, v));
-		//pr("f = %d, c = %d, so pushing %d\n", e->f, e->c, df);
-		v->e += abs(df);
-		e->f += df;
-		
-
-		totalPushed += e->c;
-		allocateNodeToThread(g, v);
-	}
-
-
+	g->begin = timebase_sec();
 
-	s->e -= totalPushed;
+	pthread_barrier_init(&g->start, NULL, nthreads);
 	
 	// Start working threads
 	for (int i = 0; i < nthreads; i += 1) {
-		if (pthread_create(&thread[i], NULL, work, (void *) &g->worker[i])) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
 			error("pthread_create failed");
 		}
+		pthread_attr_destroy(&attr);
 	}
 
-	while(1) {
+	nglobal = 0;
+	last = 0;
+
+	for (round = 1; ; round += 1) {
+		idle = stat_time();
+		span = trace_time(trace);
+
         pthread_mutex_lock(&mutex);
 		while (waitingWorkers < nthreads) {
 			pthread_cond_wait(&cond_main, &mutex);
 		}
 
+		stat_add(&g->stat, idle, stat_time() - idle);
+		trace_span(trace, "wait", span, round);
+		span = trace_time(trace);
+
+		account_round(g);
+
+		jobs = g->totalJobs;
+
 		// go through relaels and push work
 		//   allocate to next thread
 
 		for (int i = 0; i < g->n; i++) {
-			if (relabels[i]) {
+			delta_t* d = &g->delta[i];
+			if (d->relabel) {
 				relabel(g, &g->v[i]);
-				allocateNodeToThread(g, &g->v[i]);
-				relabels[i] = 0;
+				d->relabel = 0;
 			}
 			// gotta fetch atomically
-			if (delta_excess[i] != 0) {
+			if (d->e != 0) {
 				
-				g->v[i].e += delta_excess[i];
-				if (g->v[i].e > 0)
-					allocateNodeToThread(g, &g->v[i]);
-				delta_excess[i] = 0;
+				g->v[i].e += d->e;
+				d->e = 0;
+			}
+
+			/* a node is given out only after its excess is
+			 * updated, since a hub shares out what it has then.
+			 * this also catches a node which pushed away as much
+			 * as it got this round and so has no delta but still
+			 * has excess.
+			 *
+			 */
+
+			if (g->v[i].e > 0)
+				allocateNodeToThread(g, &g->v[i]);
+		}
+
+		active = g->totalJobs - jobs;
+		account_work(g, round);
+
+		trace_span(trace, "apply", span, round);
+
+		if (active > 0 && active < tail) {
+			excess = NULL;
+			for (int i = 0; i < nthreads; i++) {
+				while ((u = g->worker[i].excess) != NULL) {
+					g->worker[i].excess = u->next;
+					u->next = excess;
+					excess = u;
+				}
+
+				/* a hub is in the first of its slices. */
+
+				for (int j = 0; j < g->worker[i].nslice; j++) {
+					u = g->worker[i].slice[j].u;
+					if (g->worker[i].slice[j].begin == 0) {
+						u->next = excess;
+						excess = u;
+					}
+				}
+
+				g->worker[i].nslice = 0;
 			}
+
+			if (phase_verbose)
+				fprintf(stderr, "round %d: %d active, sequential\n", round, active);
+			span = trace_time(trace);
+			active = discharge_sequential(g, excess, active, 2 * tail);
+			trace_span(trace, "sequential", span, round);
+			if (phase_verbose && active > 0)
+				fprintf(stderr, "round %d: %d active, parallel\n", round, active);
 		}
 
 		if (-s->e == t->e) {
@@ -515,6 +2345,20 @@ int preflow(graph_t* g)
 			break;
 		}
 
+		/* the workers do a global relabel before the next round
+		 * after the first one and then when heights have been
+		 * lifted one step at a time often enough.
+		 *
+		 */
+
+		g->global = global > 0 && (round == 1
+			|| g->relabels - last >= (long) global * g->n);
+
+		if (g->global) {
+			last = g->relabels;
+			nglobal += 1;
+		}
+
 		waitingWorkers = 0;
 		pthread_cond_broadcast(&cond_worker);
 		pthread_mutex_unlock(&mutex);
@@ -528,26 +2372,51 @@ int preflow(graph_t* g)
 		}
 	}
 
+	pthread_barrier_destroy(&g->start);
+
+	/* how long it took from the start of preflow until the workers
+	 * had saturated the arcs of s and could begin the first round.
+	 *
+	 */
+
+	phase_print("first_round", g->first);
+
+	for (int i = 0; i < nthreads; i += 1)
+		g->pushes += g->worker[i].pushes;
+
+	if (phase_verbose)
+		fprintf(stderr, "rounds: %d, pushes: %ld, relabels: %ld, global relabels: %d in %.3f ms%s\n",
+			round, g->pushes, g->relabels, nglobal, g->bfs * 1e3,
+			deterministic ? ", deterministic" : "");
+
+	report_work(g);
+#if STATS
+	report_stats(g, round, nglobal);
+#endif
+	report_work_memory(g);
+	report_contention(g);
+
 	return t->e;
 }
 
 static void free_graph(graph_t* g)
 {
 	int			i;
-	list_t*		p;
-	list_t*		q;
 
-
-	for (i = 0; i < g->n; i += 1) {
-		p = g->v[i].edge;
-		while (p != NULL) {
-			q = p->next;
-			free(p);
-			p = q;
-		}
-	}
 	free(g->v);
 	free(g->e);
+	free(g->arc);
+	free(g->head);
+	free(g->side);
+	free(g->delta);
+	free(g->dist);
+	free(g->hot);
+	for (i = 0; i < g->nthreads; i += 1) {
+		free(g->worker[i].cur);
+		free(g->worker[i].next);
+		free(g->worker[i].slice);
+	}
+	free(g->worker);
 	free(g);
 }
 
@@ -558,6 +2427,8 @@ int main(int argc, char* argv[])
 	int		f;	/* output from preflow.		*/
 	int		n;	/* number of nodes.		*/
 	int		m;	/* number of edges.		*/
+	trace_t*	trace;	/* of the main thread.		*/
+	double		begin;
 
 	progname = argv[0];	/* name is a string in argv[0]. */
 
@@ -570,17 +2441,45 @@ int main(int argc, char* argv[])
 	next_int();
 	next_int();
 
-	int nthreads = 2;
+	int nthreads = options(argc, argv);
+
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
+
+	const char* kernels = select_kernel();
+
+	if (phase_verbose)
+		fprintf(stderr, "kernels: %s\n", kernels);
 
-	g = new_graph(in, n, m, nthreads);
+	trace_open(trace_file, perf);
+	trace = trace_thread(0, "main");
+
+	g = new_graph(in, n, m, nthreads, trace);
+
+	report_memory(g);
 
 	fclose(in);
 
-	f = preflow(g);
+	phase_print("parse", g->read);
+	phase_print("build", g->build);
+
+	PHASE("solve") {
+		f = preflow(g);
+	}
 
 	printf("f = %d\n", f);
 
-	free_graph(g);
+	memory_peak();
+
+	begin = trace_time(trace);
+
+	PHASE("teardown") {
+		free_graph(g);
+	}
+
+	trace_span(trace, "teardown", begin, 0);
 
 	return 0;
 }
@@ -0,0 +1,1083 @@
+/*
+OWNER PARTITIONED (each worker owns a range of nodes, pushes to
+nodes of other workers are sent as messages through ring buffers)
+
+Only the owner of a node reads or writes its excess and the residual
+capacities of its adjacency list. A push from u to v lowers the residual
+of the arc u->v and, if v has another owner, sends (v, v->u, d) to that
+owner which then adds d to the excess of v and to the residual of v->u.
+
+Rounds are separated by barriers so that heights do not change while
+workers discharge: in the first phase every worker discharges its own
+active nodes with the heights of the previous round, and in the second
+phase it relabels the nodes which could not push. There is one single
+producer/single consumer ring for each ordered pair of workers.
+
+The main thread only reads the edges. Each worker then clears its own
+range of nodes and builds the arcs of those nodes and the rings it
+receives on, so on a NUMA machine all of it is first touched, and thus
+placed, on the memory node of that worker.
+*/
+
+#define _GNU_SOURCE
+
+#include <alloca.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "timebase.h"
+#include <sys/syscall.h>
+
+#define PRINT		0	/* enable/disable prints. */
+#define CACHE_LINE	64	/* bytes in a cache block.	*/
+#define RING_SIZE	256	/* messages per ring, power of two. */
+#define MAX_NODES	64	/* numa nodes looked for.	*/
+
+/* the funny do-while next clearly performs one iteration of the loop.
+ * if you are really curious about why there is a loop, please check
+ * the course book about the C preprocessor where it is explained. it
+ * is to avoid bugs and/or syntax errors in case you use the pr in an
+ * if-statement without { }.
+ *
+ */
+
+#if PRINT
+#define pr(...)		do { fprintf(stderr, __VA_ARGS__); } while (0)
+#else
+#define pr(...)		/* no effect at all */
+#endif
+
+#define MIN(a,b)	(((a)<=(b))?(a):(b))
+
+typedef struct graph_t	graph_t;
+typedef struct node_t	node_t;
+typedef struct edge_t	edge_t;
+typedef struct list_t	list_t;
+typedef struct worker_t worker_t;
+typedef struct msg_t	msg_t;
+typedef struct ring_t	ring_t;
+
+struct list_t {
+	edge_t*		edge;
+	list_t*		next;
+	node_t*		v;	/* the other node of the edge.	*/
+	list_t*		rev;	/* the edge in the list of v.	*/
+	int		r;	/* residual capacity to v.	*/
+};
+
+struct node_t {
+	int		h;		/* height.			*/
+	int		e;		/* excess flow.			*/
+	list_t*		edge;		/* adjacency list.		*/
+	node_t*		next;		/* with excess preflow.		*/
+	int		in_queue;
+	int		h_new;		/* height after this round or 0. */
+	int		in_relabel;
+	node_t*		next_relabel;
+};
+
+struct edge_t {
+	node_t*		u;	/* one of the two nodes.	*/
+	node_t*		v;	/* the other. 			*/
+	int		c;	/* capacity.			*/
+	list_t*		a[2];	/* arcs in the lists of u and v. */
+};
+
+struct msg_t {
+	node_t*		v;	/* node receiving the flow.	*/
+	list_t*		a;	/* arc from v back to the sender. */
+	int		d;	/* amount of flow.		*/
+};
+
+struct ring_t {
+	_Atomic unsigned	head;	/* next to read, only consumer writes. */
+	char			pad0[CACHE_LINE - sizeof(unsigned)];
+	_Atomic unsigned	tail;	/* next to write, only producer writes. */
+	char			pad1[CACHE_LINE - sizeof(unsigned)];
+	msg_t			msg[RING_SIZE];
+};
+
+struct graph_t {
+	int		n;	/* nodes.			*/
+	int		m;	/* edges.			*/
+	int		nthreads;
+	int		chunk;	/* nodes per worker.		*/
+	worker_t*	worker;
+	ring_t**	ring;	/* nthreads rings to each worker. */
+	node_t*		v;	/* array of n nodes.		*/
+	edge_t*		e;	/* array of m edges.		*/
+	node_t*		s;	/* source.			*/
+	node_t*		t;	/* sink.			*/
+	_Atomic int	waiting;	/* workers in the barrier.	*/
+	_Atomic int	sense;		/* flips when the barrier opens. */
+	_Atomic int	active[2];	/* active nodes, by round parity. */
+	double		begin;	/* timebase_sec() when preflow started. */
+	double		build;	/* seconds until all arcs were made. */
+};
+
+struct worker_t {
+	int		i;
+	graph_t*	g;
+	node_t*		excess;		/* own nodes with e > 0 except s,t. */
+	node_t*		relabel;	/* own nodes to relabel after round. */
+	int		sense;
+	int		node;		/* numa node when building.	*/
+	list_t*		arc;		/* arcs of own nodes.		*/
+	int		narc;
+	unsigned long	pushes;		/* all pushes made.		*/
+	unsigned long	remote;		/* pushes to another worker.	*/
+} __attribute__((aligned(CACHE_LINE)));
+
+static char* progname;
+
+static int		nnodes;			/* numa nodes.			*/
+static int		cpu_node[CPU_SETSIZE];	/* numa node of each cpu.	*/
+static int		node_cpus[MAX_NODES];	/* cpus of each numa node.	*/
+
+static int id(graph_t* g, node_t* v)
+{
+	return v - g->v;
+}
+
+void error(const char* fmt, ...)
+{
+
+	va_list		ap;
+	char		buf[BUFSIZ];
+
+	va_start(ap, fmt);
+	vsprintf(buf, fmt, ap);
+
+	if (progname != NULL)
+		fprintf(stderr, "%s: ", progname);
+
+	fprintf(stderr, "error: %s\n", buf);
+	exit(1);
+}
+
+static int next_int()
+{
+        int     x;
+        int     c;
+
+	x = 0;
+        while (isdigit(c = getchar()))
+                x = 10 * x + c - '0';
+
+        return x;
+}
+
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:v")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'v':
+			phase_verbose = 1;
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-v] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+
+static void* xmalloc(size_t s)
+{
+	void*		p;
+
+	p = malloc(s);
+
+	if (p == NULL)
+		error("out of memory: malloc(%zu) failed", s);
+
+	return p;
+}
+
+static void* xcalloc(size_t n, size_t s)
+{
+	void*		p;
+
+	p = xmalloc(n * s);
+
+	memset(p, 0, n * s);
+
+
+	return p;
+}
+
+static void* xaligned_alloc(size_t n, size_t s)
+{
+	void*		p;
+	size_t		size;
+
+	/* the memory is not touched here so that each page is placed
+	 * near the thread that first writes to it.
+	 *
+	 */
+
+	size = (n * s + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+	p = aligned_alloc(CACHE_LINE, size == 0 ? CACHE_LINE : size);
+
+	if (p == NULL)
+		error("out of memory: aligned_alloc(%zu) failed", size);
+
+	return p;
+}
+
+static void* xaligned_calloc(size_t n, size_t s)
+{
+	void*		p;
+
+	p = xaligned_alloc(n, s);
+
+	memset(p, 0, n * s);
+
+	return p;
+}
+
+static void read_nodes(void)
+{
+	char		name[128];
+	FILE*		fp;
+	int		k;
+	int		a;
+	int		b;
+	int		c;
+
+	/* map each cpu to its numa node. the cpulist of a node is a
+	 * comma separated list of cpus and ranges such as 0-3,8-11.
+	 * without sysfs everything is on one node.
+	 *
+	 */
+
+	for (k = 0; k < MAX_NODES; k += 1) {
+		snprintf(name, sizeof name,
+			"/sys/devices/system/node/node%d/cpulist", k);
+
+		fp = fopen(name, "r");
+		if (fp == NULL)
+			continue;
+
+		nnodes += 1;
+
+		while (fscanf(fp, "%d", &a) == 1) {
+			b = a;
+			c = fgetc(fp);
+			if (c == '-') {
+				if (fscanf(fp, "%d", &b) != 1)
+					break;
+				c = fgetc(fp);
+			}
+			for (; a <= b && a < CPU_SETSIZE; a += 1) {
+				cpu_node[a] = k;
+				node_cpus[k] += 1;
+			}
+			if (c != ',')
+				break;
+		}
+
+		fclose(fp);
+	}
+
+	if (nnodes == 0) {
+		nnodes = 1;
+		node_cpus[0] = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+}
+
+static void pages_on_node(void* p, size_t size, int node, int* local, int* total)
+{
+	void*		page[64];
+	int		status[64];
+	uintptr_t	a;
+	uintptr_t	end;
+	long		pagesize;
+	int		i;
+	int		k;
+
+	/* ask the kernel where the pages are. move_pages with no target
+	 * nodes does not move anything, it only reports the node of each
+	 * page or a negative error such as -ENOENT if not yet touched.
+	 *
+	 */
+
+	*local = 0;
+	*total = 0;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	a = (uintptr_t) p & ~(uintptr_t) (pagesize - 1);
+	end = (uintptr_t) p + size;
+
+	while (a < end) {
+		for (k = 0; k < 64 && a < end; k += 1, a += pagesize)
+			page[k] = (void*) a;
+
+		if (syscall(SYS_move_pages, 0, k, page, NULL, status, 0) != 0)
+			return;
+
+		for (i = 0; i < k; i += 1) {
+			*total += 1;
+			*local += status[i] == node;
+		}
+	}
+}
+
+static void report_topology(graph_t* g)
+{
+	int		k;
+
+	if (!phase_verbose)
+		return;
+
+	fprintf(stderr, "numa: %d node%s, %d workers\n", nnodes,
+		nnodes == 1 ? "" : "s", g->nthreads);
+
+	for (k = 0; k < MAX_NODES; k += 1)
+		if (node_cpus[k] > 0)
+			fprintf(stderr, "numa: node %d has %d cpu%s\n", k, node_cpus[k],
+				node_cpus[k] == 1 ? "" : "s");
+}
+
+static void report_placement(graph_t* g)
+{
+	worker_t*	worker;
+	int		begin;
+	int		end;
+	int		i;
+	int		nl, nt;
+	int		al, at;
+	int		rl, rt;
+
+	/* on one node every page is local and nothing is worth saying. */
+
+	if (!phase_verbose || nnodes < 2)
+		return;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		worker = &g->worker[i];
+		begin = MIN(i * g->chunk, g->n);
+		end = MIN(begin + g->chunk, g->n);
+
+		pages_on_node(&g->v[begin], (end - begin) * sizeof(node_t), worker->node, &nl, &nt);
+		pages_on_node(worker->arc, worker->narc * sizeof(list_t), worker->node, &al, &at);
+		pages_on_node(g->ring[i], g->nthreads * sizeof(ring_t), worker->node, &rl, &rt);
+
+		fprintf(stderr, "numa: worker %d on node %d: local pages "
+			"nodes %d/%d, arcs %d/%d, rings %d/%d\n",
+			i, worker->node, nl, nt, al, at, rl, rt);
+	}
+}
+
+static graph_t* new_graph(int n, int m, int nthreads)
+{
+	graph_t*	g;
+	edge_t*		e;
+	int		i;
+	int		a;
+	int		b;
+	int		c;
+	long		source;
+	long		sink;
+
+	g = xmalloc(sizeof(graph_t));
+
+	g->n = n;
+	g->m = m;
+
+	/* only the edges are read here. the nodes and the adjacency
+	 * lists are made by the workers in build.
+	 *
+	 */
+
+	g->v = xaligned_alloc(n, sizeof(node_t));
+	g->e = xcalloc(m, sizeof(edge_t));
+
+	g->nthreads = nthreads;
+	g->chunk = (n + nthreads - 1) / nthreads;
+
+	g->worker = xaligned_calloc(nthreads, sizeof(worker_t));
+	for (i = 0; i < nthreads; i += 1) {
+		g->worker[i].i = i;
+		g->worker[i].g = g;
+	}
+
+	g->ring = xcalloc(nthreads, sizeof(ring_t*));
+
+	g->waiting = 0;
+	g->sense = 0;
+	g->active[0] = 0;
+	g->active[1] = 0;
+
+	source = 0;
+	sink = 0;
+
+	PHASE("parse") {
+		for (i = 0; i < m; i += 1) {
+			a = next_int();
+			b = next_int();
+			c = next_int();
+			e = &g->e[i];
+			e->u = &g->v[a];
+			e->v = &g->v[b];
+			e->c = c;
+
+			if (a == 0)
+				source += c;
+			if (b == 0)
+				source += c;
+			if (a == n-1)
+				sink += c;
+			if (b == n-1)
+				sink += c;
+		}
+	}
+
+	// switch source and sink here if sounce flow is more than sink flow
+	if (sink < source) {
+		g->s = &g->v[n-1];
+		g->t = &g->v[0];
+	} else {
+		g->s = &g->v[0];
+		g->t = &g->v[n-1];
+	}
+
+	return g;
+}
+
+static int owner(graph_t* g, node_t* v)
+{
+	return id(g, v) / g->chunk;
+}
+
+static void add_arc(node_t* u, node_t* v, edge_t* e, list_t* a)
+{
+	/* put the arc a first in the adjacency list of u. the edge is
+	 * undirected so both arcs start with the full capacity as
+	 * residual.
+	 *
+	 */
+
+	a->edge = e;
+	a->v = v;
+	a->r = e->c;
+	a->rev = NULL;
+	a->next = u->edge;
+	u->edge = a;
+}
+
+static void build(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+	edge_t*		e;
+	int		begin;
+	int		end;
+	int		i;
+	int		k;
+
+	/* clear our nodes and make their arcs and the rings we receive
+	 * on. every page written here is then on our numa node.
+	 *
+	 */
+
+	begin = MIN(worker->i * g->chunk, g->n);
+	end = MIN(begin + g->chunk, g->n);
+
+	memset(&g->v[begin], 0, (end - begin) * sizeof(node_t));
+
+	if (owner(g, g->s) == worker->i)
+		g->s->h = g->n;
+
+	k = 0;
+	for (i = 0; i < g->m; i += 1) {
+		e = &g->e[i];
+		k += owner(g, e->u) == worker->i;
+		k += owner(g, e->v) == worker->i;
+	}
+
+	worker->narc = k;
+	worker->arc = xaligned_alloc(k, sizeof(list_t));
+
+	k = 0;
+	for (i = 0; i < g->m; i += 1) {
+		e = &g->e[i];
+		if (owner(g, e->u) == worker->i) {
+			e->a[0] = &worker->arc[k++];
+			add_arc(e->u, e->v, e, e->a[0]);
+		}
+		if (owner(g, e->v) == worker->i) {
+			e->a[1] = &worker->arc[k++];
+			add_arc(e->v, e->u, e, e->a[1]);
+		}
+	}
+
+	g->ring[worker->i] = xaligned_calloc(g->nthreads, sizeof(ring_t));
+
+	i = sched_getcpu();
+	worker->node = i < 0 ? 0 : cpu_node[MIN(i, CPU_SETSIZE - 1)];
+}
+
+static void link_arcs(worker_t* worker)
+{
+	list_t*		a;
+	edge_t*		e;
+	int		k;
+
+	/* every worker has made its arcs so the reverse arcs exist. */
+
+	for (k = 0; k < worker->narc; k += 1) {
+		a = &worker->arc[k];
+		e = a->edge;
+		a->rev = a == e->a[0] ? e->a[1] : e->a[0];
+	}
+}
+
+static void enter_excess(worker_t* worker, node_t* v)
+{
+	graph_t*	g = worker->g;
+
+	/* v has new excess so a relabel decided before it got the
+	 * excess may be wrong and is cancelled. v is discharged again
+	 * with its current height instead.
+	 *
+	 */
+
+	if (v == g->s || v == g->t)
+		return;
+
+	v->h_new = 0;
+
+	if (!v->in_queue) {
+		v->in_queue = 1;
+		v->next = worker->excess;
+		worker->excess = v;
+	}
+}
+
+static node_t* leave_excess(worker_t* worker)
+{
+	node_t*		v;
+
+	v = worker->excess;
+
+	if (v != NULL) {
+		worker->excess = v->next;
+		v->next = NULL;
+		v->in_queue = 0;
+	}
+
+	return v;
+}
+
+static void drain(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+	ring_t*		ring;
+	msg_t*		msg;
+	unsigned	head;
+	unsigned	tail;
+	int		i;
+
+	/* apply all messages sent to this worker so far. */
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		ring = &g->ring[worker->i][i];
+		head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+		while (head != tail) {
+			msg = &ring->msg[head % RING_SIZE];
+			msg->v->e += msg->d;
+			msg->a->r += msg->d;
+			enter_excess(worker, msg->v);
+			head += 1;
+		}
+
+		atomic_store_explicit(&ring->head, head, memory_order_release);
+	}
+}
+
+static void send(worker_t* worker, int to, node_t* v, list_t* a, int d)
+{
+	graph_t*	g = worker->g;
+	ring_t*		ring;
+	msg_t*		msg;
+	unsigned	tail;
+
+	ring = &g->ring[to][worker->i];
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	/* if the ring is full the owner of v is either discharging or
+	 * waiting in the barrier, and both drain their rings. we drain
+	 * our own meanwhile so that two workers sending to each other
+	 * cannot wait for each other forever.
+	 *
+	 */
+
+	while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == RING_SIZE) {
+		drain(worker);
+		sched_yield();
+	}
+
+	msg = &ring->msg[tail % RING_SIZE];
+	msg->v = v;
+	msg->a = a;
+	msg->d = d;
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void barrier(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+
+	/* a sense reversing barrier which keeps draining the rings
+	 * while waiting since other workers may be blocked on a full
+	 * ring to us.
+	 *
+	 */
+
+	worker->sense = !worker->sense;
+
+	if (atomic_fetch_add(&g->waiting, 1) == g->nthreads - 1) {
+		atomic_store(&g->waiting, 0);
+		atomic_store(&g->sense, worker->sense);
+	} else {
+		while (atomic_load(&g->sense) != worker->sense) {
+			drain(worker);
+			sched_yield();
+		}
+	}
+}
+
+static void push(worker_t* worker, node_t* u, list_t* a, int d)
+{
+	graph_t*	g = worker->g;
+	node_t*		v = a->v;
+	int		i;
+
+	pr("@T%d: push from %d to %d: %d\n", worker->i, id(g, u), id(g, v), d);
+
+	u->e -= d;
+	a->r -= d;
+
+	worker->pushes += 1;
+
+	i = owner(g, v);
+
+	if (i == worker->i) {
+		v->e += d;
+		a->rev->r += d;
+		enter_excess(worker, v);
+	} else {
+		worker->remote += 1;
+		send(worker, i, v, a->rev, d);
+	}
+}
+
+static void discharge(worker_t* worker, node_t* u)
+{
+	list_t*		p;
+	int		h;
+
+	/* push to every lower neighbor with residual capacity. heights
+	 * of other nodes do not change during this phase.
+	 *
+	 */
+
+	for (p = u->edge; p != NULL && u->e > 0; p = p->next)
+		if (u->h > p->v->h && p->r > 0)
+			push(worker, u, p, MIN(u->e, p->r));
+
+	if (u->e == 0)
+		return;
+
+	/* relabel to one above the lowest neighbor we can push to, but
+	 * only at the end of the round when nobody reads heights.
+	 *
+	 */
+
+	h = 2 * worker->g->n;
+
+	for (p = u->edge; p != NULL; p = p->next)
+		if (p->r > 0 && p->v->h < h)
+			h = p->v->h;
+
+	u->h_new = MIN(h, 2 * worker->g->n - 1) + 1;
+
+	if (!u->in_relabel) {
+		u->in_relabel = 1;
+		u->next_relabel = worker->relabel;
+		worker->relabel = u;
+	}
+}
+
+static void relabel(worker_t* worker)
+{
+	node_t*		u;
+
+	while ((u = worker->relabel) != NULL) {
+		worker->relabel = u->next_relabel;
+		u->next_relabel = NULL;
+		u->in_relabel = 0;
+
+		if (u->h_new > 0) {
+			pr("@T%d: relabel %d now h = %d\n", worker->i, id(worker->g, u), u->h_new);
+			u->h = u->h_new;
+			u->h_new = 0;
+			enter_excess(worker, u);
+		}
+	}
+}
+
+static void *work(void* args)
+{
+	worker_t*	worker = (worker_t*) args;
+	graph_t*	g = worker->g;
+	node_t*		u;
+	list_t*		p;
+	int		round;
+	int		active;
+
+	build(worker);
+
+	/* the rings to every worker exist after the barrier. */
+
+	barrier(worker);
+	link_arcs(worker);
+
+	if (worker->i == 0)
+		g->build = timebase_sec() - g->begin;
+
+	/* push as much as possible (limited by the edge capacity) from
+	 * the source to its neighbors as in any other push, so flow to
+	 * nodes of other workers is sent to them as messages.
+	 *
+	 */
+
+	if (owner(g, g->s) == worker->i)
+		for (p = g->s->edge; p != NULL; p = p->next)
+			push(worker, g->s, p, p->r);
+
+	for (round = 0; ; round += 1) {
+
+		while ((u = leave_excess(worker)) != NULL) {
+			discharge(worker, u);
+			drain(worker);
+		}
+
+		barrier(worker);
+
+		/* every message of this round was sent before the barrier. */
+
+		drain(worker);
+		relabel(worker);
+
+		active = 0;
+		for (u = worker->excess; u != NULL; u = u->next)
+			active += 1;
+
+		atomic_fetch_add(&g->active[round & 1], active);
+
+		barrier(worker);
+
+		if (atomic_load(&g->active[round & 1]) == 0)
+			return NULL;
+
+		/* everybody has read the counter of the previous round. */
+
+		if (worker->i == 0)
+			atomic_store(&g->active[(round + 1) & 1], 0);
+	}
+}
+
+int preflow(graph_t* g)
+{
+	worker_t*	worker;
+	unsigned long	pushes;
+	unsigned long	remote;
+	int		nthreads = g->nthreads;
+	int		i;
+	pthread_t	thread[nthreads];
+	pthread_attr_t	attr;
+
+	g->begin = timebase_sec();
+
+	read_nodes();
+	report_topology(g);
+
+	for (i = 0; i < nthreads; i += 1) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
+			error("pthread_create failed");
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	for (i = 0; i < nthreads; i += 1) {
+		if (pthread_join(thread[i], NULL) != 0)  {
+			error("pthread_join failed");
+		}
+	}
+
+	pushes = 0;
+	remote = 0;
+
+	for (i = 0; i < nthreads; i += 1) {
+		worker = &g->worker[i];
+		pushes += worker->pushes;
+		remote += worker->remote;
+	}
+
+	report_placement(g);
+
+	if (phase_verbose)
+		fprintf(stderr, "cross-partition pushes: %lu of %lu (%.1f%%)\n",
+			remote, pushes, pushes == 0 ? 0.0 : 100.0 * remote / pushes);
+
+	return g->t->e;
+}
+
+static void free_graph(graph_t* g)
+{
+	int		i;
+
+	for (i = 0; i < g->nthreads; i += 1) {
+		free(g->worker[i].arc);
+		free(g->ring[i]);
+	}
+
+	free(g->v);
+	free(g->e);
+	free(g->ring);
+	free(g->worker);
+	free(g);
+}
+
+int main(int argc, char* argv[])
+{
+	FILE*		in;	/* input file set to stdin	*/
+	graph_t*	g;	/* undirected graph. 		*/
+	int		f;	/* output from preflow.		*/
+	int		n;	/* number of nodes.		*/
+	int		m;	/* number of edges.		*/
+	double		begin;
+
+	progname = argv[0];	/* name is a string in argv[0]. */
+
+	in = stdin;		/* same as System.in in Java.	*/
+
+	n = next_int();
+	m = next_int();
+
+	/* skip C and P from the 6railwayplanning lab in EDAF05 */
+	next_int();
+	next_int();
+
+	int nthreads = options(argc, argv);
+
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
+
+	g = new_graph(n, m, nthreads);
+
+	fclose(in);
+
+	/* the workers make the arcs of their own nodes first in preflow,
+	 * so that time is taken out of solve.
+	 *
+	 */
+
+	begin = timebase_sec();
+	f = preflow(g);
+	phase_print("build", g->build);
+	phase_print("solve", timebase_sec() - begin - g->build);
+
+	printf("f = %d\n", f);
+
+	PHASE("teardown") {
+		free_graph(g);
+	}
+
+	return 0;
+}
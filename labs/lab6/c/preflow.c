@@ -0,0 +1,1008 @@
+/*
+TRANSACTIONAL MEMORY (every push and relabel is a __transaction_atomic
+block, compiled with -fgnu-tm and run by GCC's libitm)
+
+Workers take nodes from their own excess lists and push without rounds,
+as in lab 2. Instead of locking u and v in id order, a push reads both
+heights and updates e->f, u->e and v->e in one transaction. If v gets
+excess it is put in the excess list of some worker in the same
+transaction.
+
+With TM set to 0 the same engine uses the ordered node locks of lab 2
+instead, which is what we compare against. Compile with make lock.
+*/
+
+#define _GNU_SOURCE
+
+#include <alloca.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "timebase.h"
+
+#define PRINT	0	/* enable/disable prints. */
+
+#ifndef TM
+#define TM	1	/* transactions instead of locks. */
+#endif
+
+/* the funny do-while next clearly performs one iteration of the loop.
+ * if you are really curious about why there is a loop, please check
+ * the course book about the C preprocessor where it is explained. it
+ * is to avoid bugs and/or syntax errors in case you use the pr in an
+ * if-statement without { }.
+ *
+ */
+
+#if PRINT
+#define pr(...)		do { fprintf(stderr, __VA_ARGS__); } while (0)
+#else
+#define pr(...)		/* no effect at all */
+#endif
+
+#define MIN(a,b)	(((a)<=(b))?(a):(b))
+
+#if TM
+
+/* from libitm.h which is not always installed. a transaction runs
+ * irrevocably when libitm has given up on retrying it and instead
+ * runs it alone.
+ *
+ */
+
+typedef enum {
+	outsideTransaction = 0,
+	inRetryableTransaction,
+	inIrrevocableTransaction
+} _ITM_howExecuting;
+
+extern _ITM_howExecuting _ITM_inTransaction(void) __attribute__((transaction_pure));
+
+/* an aborted transaction starts over from where it began, much as a
+ * longjmp to a setjmp, and gcc restores the locals it changed, but
+ * -Wextra still warns that every local live across one may be
+ * clobbered.
+ *
+ */
+
+#pragma GCC diagnostic ignored "-Wclobbered"
+
+#endif
+
+typedef struct graph_t	graph_t;
+typedef struct node_t	node_t;
+typedef struct edge_t	edge_t;
+typedef struct list_t	list_t;
+typedef struct worker_t worker_t;
+
+struct list_t {
+	edge_t*		edge;
+	list_t*		next;
+};
+
+struct node_t {
+	int			h;		/* height.			*/
+	int			e;		/* excess flow.			*/
+	int			inQueue;/* is in someones excess list */
+	list_t*		edge;	/* adjacency list.		*/
+	node_t*		next;	/* with excess preflow.		*/
+#if !TM
+	pthread_mutex_t nodeLock;
+#endif
+};
+
+struct edge_t {
+	node_t*		u;	/* one of the two nodes.	*/
+	node_t*		v;	/* the other. 			*/
+	int			f;	/* flow > 0 if from u to v.	*/
+	int			c;	/* capacity.			*/
+};
+
+struct graph_t {
+	int		n;	/* nodes.			*/
+	int		m;	/* edges.			*/
+	int    	nthreads;
+	int		active;	/* nodes in some excess list.	*/
+	worker_t* 	worker;
+	node_t*		v;	/* array of n nodes.		*/
+	edge_t*		e;	/* array of m edges.		*/
+	node_t*		s;	/* source.			*/
+	node_t*		t;	/* sink.			*/
+};
+
+struct worker_t {
+#if !TM
+	pthread_mutex_t excessMutex;
+#endif
+	int			i;
+	int			next;		/* worker to give the next node. */
+	node_t*		excess;	/* nodes with e > 0 except s,t.	*/
+	graph_t*	g;		/* pointer to graph */
+	unsigned long	commits;	/* pushes and relabels done.	*/
+	unsigned long	attempts;	/* also counts the aborted ones. */
+	unsigned long	serial;		/* attempts run irrevocably.	*/
+	_Atomic int	parked;		/* 1 while waiting for work.	*/
+} __attribute__((aligned(64)));
+
+static char* progname;
+
+void error(const char* fmt, ...)
+{
+
+	va_list		ap;
+	char		buf[BUFSIZ];
+
+	va_start(ap, fmt);
+	vsprintf(buf, fmt, ap);
+
+	if (progname != NULL)
+		fprintf(stderr, "%s: ", progname);
+
+	fprintf(stderr, "error: %s\n", buf);
+	exit(1);
+}
+
+static int next_int()
+{
+        int     x;
+        int     c;
+
+	x = 0;
+        while (isdigit(c = getchar()))
+                x = 10 * x + c - '0';
+
+        return x;
+}
+
+/* the number of worker threads is taken from -t, then PREFLOW_THREADS,
+ * and is otherwise the number of online cpus. the workers can also be
+ * pinned with -a or PREFLOW_AFFINITY: compact puts worker i on the
+ * i:th allowed cpu, ordered by package and core so that neighbors in
+ * the order share caches, and scatter spreads the workers evenly over
+ * the same order so that they share as little as possible.
+ *
+ */
+
+enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER };
+
+static int		affinity = AFFINITY_NONE;
+static int		ncpu;		/* allowed cpus, or 0 if not yet read. */
+static int		cpu[CPU_SETSIZE];
+
+static int parse_threads(const char* s)
+{
+	char*		end;
+	long		n;
+
+	n = strtol(s, &end, 10);
+
+	if (*s == 0 || *end != 0 || n < 1 || n > CPU_SETSIZE)
+		error("bad thread count \"%s\"", s);
+
+	return n;
+}
+
+static int parse_affinity(const char* s)
+{
+	if (strcmp(s, "none") == 0)
+		return AFFINITY_NONE;
+	else if (strcmp(s, "compact") == 0)
+		return AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		return AFFINITY_SCATTER;
+
+	error("bad affinity \"%s\": use none, compact or scatter", s);
+
+	return AFFINITY_NONE;
+}
+
+static void read_options(void)
+{
+	const char*	s;
+
+	/* the options which can also be given as PREFLOW_* variables.
+	 * arguments, where there are any, are read after and win.
+	 *
+	 */
+
+	s = getenv("PREFLOW_AFFINITY");
+	if (s != NULL)
+		affinity = parse_affinity(s);
+}
+
+static int default_threads(void)
+{
+	const char*	s;
+	long		n;
+
+	s = getenv("PREFLOW_THREADS");
+	if (s != NULL)
+		return parse_threads(s);
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n;
+}
+
+static int topology(int c, const char* what)
+{
+	char		name[128];
+	FILE*		fp;
+	int		x;
+
+	snprintf(name, sizeof name,
+		"/sys/devices/system/cpu/cpu%d/topology/%s", c, what);
+
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "%d", &x) != 1)
+		x = 0;
+
+	fclose(fp);
+
+	return x;
+}
+
+static void read_cpus(void)
+{
+	cpu_set_t	set;
+	int		key[CPU_SETSIZE];
+	int		c;
+	int		i;
+	int		k;
+
+	if (sched_getaffinity(0, sizeof set, &set) != 0)
+		error("sched_getaffinity failed");
+
+	/* sort the allowed cpus by package, core and cpu number, which
+	 * puts hyperthreads of the same core next to each other.
+	 *
+	 */
+
+	for (c = 0; c < CPU_SETSIZE; c += 1) {
+		if (!CPU_ISSET(c, &set))
+			continue;
+
+		k = (topology(c, "physical_package_id") << 16)
+			| (topology(c, "core_id") & 0xffff);
+
+		for (i = ncpu; i > 0 && key[i-1] > k; i -= 1) {
+			key[i] = key[i-1];
+			cpu[i] = cpu[i-1];
+		}
+
+		key[i] = k;
+		cpu[i] = c;
+		ncpu += 1;
+	}
+
+	if (ncpu == 0)
+		error("no cpu to run on");
+
+}
+
+static void thread_attr(pthread_attr_t* attr, int i, int nthreads)
+{
+	cpu_set_t	set;
+	int		k;
+
+	pthread_attr_init(attr);
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	if (ncpu == 0)
+		read_cpus();
+
+	if (affinity == AFFINITY_COMPACT)
+		k = i % ncpu;
+	else
+		k = (long) i * ncpu / nthreads % ncpu;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu[k], &set);
+
+	if (pthread_attr_setaffinity_np(attr, sizeof set, &set) != 0)
+		error("pthread_attr_setaffinity_np failed");
+}
+
+static int options(int argc, char* argv[])
+{
+	int		nthreads;
+	int		c;
+
+	read_options();
+	nthreads = default_threads();
+
+	while ((c = getopt(argc, argv, "t:a:v")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = parse_threads(optarg);
+			break;
+
+		case 'a':
+			affinity = parse_affinity(optarg);
+			break;
+
+		case 'v':
+			phase_verbose = 1;
+			break;
+
+		default:
+			error("usage: %s [-t threads] [-a none|compact|scatter] [-v] < input", progname);
+		}
+	}
+
+	return nthreads;
+}
+
+static void* xmalloc(size_t s)
+{
+	void*		p;
+
+	p = malloc(s);
+
+	if (p == NULL)
+		error("out of memory: malloc(%zu) failed", s);
+
+	return p;
+}
+
+static void* xcalloc(size_t n, size_t s)
+{
+	void*		p;
+
+	p = xmalloc(n * s);
+
+	memset(p, 0, n * s);
+
+
+	return p;
+}
+
+static void add_edge(node_t* u, edge_t* e)
+{
+	list_t*		p;
+
+	/* allocate memory for a list link and put it first
+	 * in the adjacency list of u.
+	 *
+	 */
+
+	p = xmalloc(sizeof(list_t));
+	p->edge = e;
+	p->next = u->edge;
+	u->edge = p;
+}
+
+static void connect(node_t* u, node_t* v, int c, edge_t* e)
+{
+	/* connect two nodes by putting a shared (same object)
+	 * in their adjacency lists.
+	 *
+	 */
+
+	e->u = u;
+	e->v = v;
+	e->c = c;
+
+	add_edge(u, e);
+	add_edge(v, e);
+}
+
+static graph_t* new_graph(int n, int m, int nthreads)
+{
+	graph_t*	g;
+	node_t*		u;
+	node_t*		v;
+	int		i;
+	int		a;
+	int		b;
+	int		c;
+
+	g = xmalloc(sizeof(graph_t));
+
+	g->n = n;
+	g->m = m;
+
+	g->v = xcalloc(n, sizeof(node_t));
+	g->e = xcalloc(m, sizeof(edge_t));
+
+	g->s = &g->v[0];
+	g->t = &g->v[n-1];
+
+	g->nthreads = nthreads;
+	g->active = 0;
+
+	g->worker = aligned_alloc(64, nthreads * sizeof(worker_t));
+	if (g->worker == NULL)
+		error("out of memory: aligned_alloc failed");
+	memset(g->worker, 0, nthreads * sizeof(worker_t));
+
+	for (i = 0; i < nthreads; i += 1) {
+		g->worker[i].i = i;
+		g->worker[i].g = g;
+		g->worker[i].next = i;
+#if !TM
+		pthread_mutex_init(&g->worker[i].excessMutex, NULL);
+#endif
+	}
+
+#if !TM
+	for (i = 0; i < n; i += 1)
+		pthread_mutex_init(&g->v[i].nodeLock, NULL);
+#endif
+
+	/* the edges are read first and then put in the adjacency lists,
+	 * so that -v can tell how long each takes.
+	 *
+	 */
+
+	PHASE("parse") {
+		for (i = 0; i < m; i += 1) {
+			a = next_int();
+			b = next_int();
+			c = next_int();
+			g->e[i].u = &g->v[a];
+			g->e[i].v = &g->v[b];
+			g->e[i].c = c;
+		}
+	}
+
+	PHASE("build") {
+		for (i = 0; i < m; i += 1) {
+			u = g->e[i].u;
+			v = g->e[i].v;
+			connect(u, v, g->e[i].c, &g->e[i]);
+		}
+	}
+
+	return g;
+}
+
+static int min_height(node_t* u)
+{
+	list_t*		p;
+	edge_t*		e;
+	node_t*		v;
+	int		h;
+
+	/* one more than the lowest neighbor we can push to. the caller
+	 * makes sure no flow to or from u changes meanwhile.
+	 *
+	 */
+
+	h = -1;
+
+	for (p = u->edge; p != NULL; p = p->next) {
+		e = p->edge;
+		if (u == e->u) {
+			v = e->v;
+			if (e->f == e->c)
+				continue;
+		} else {
+			v = e->u;
+			if (-e->f == e->c)
+				continue;
+		}
+		if (h < 0 || v->h < h)
+			h = v->h;
+	}
+
+	if (h < 0 || h < u->h)
+		return u->h + 1;
+
+	return h + 1;
+}
+
+static void futex_wait(_Atomic int* p, int value)
+{
+	/* sleep unless *p has changed from value. */
+
+	syscall(SYS_futex, p, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic int* p)
+{
+	syscall(SYS_futex, p, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void unpark(worker_t* worker)
+{
+	if (atomic_exchange(&worker->parked, 0))
+		futex_wake(&worker->parked);
+}
+
+static void unpark_all(graph_t* g)
+{
+	int		i;
+
+	for (i = 0; i < g->nthreads; i += 1)
+		unpark(&g->worker[i]);
+}
+
+static worker_t* next_worker(worker_t* worker)
+{
+	graph_t*	g = worker->g;
+
+	/* hand out new nodes round robin, but from a counter of our
+	 * own so that workers do not conflict on a shared one.
+	 *
+	 */
+
+	worker->next = (worker->next + 1) % g->nthreads;
+
+	return &g->worker[worker->next];
+}
+
+#if TM
+
+static void count_attempt(worker_t* worker) __attribute__((transaction_pure));
+
+static void count_attempt(worker_t* worker)
+{
+	/* called first in every transaction. it is pure so it is not
+	 * rolled back and the count includes attempts that aborted.
+	 *
+	 */
+
+	worker->attempts += 1;
+	if (_ITM_inTransaction() == inIrrevocableTransaction)
+		worker->serial += 1;
+}
+
+static int push(worker_t* worker, node_t* u, node_t* v, edge_t* e, int* left)
+{
+	graph_t*	g = worker->g;
+	worker_t*	to;
+	int		d;
+	int		add;
+
+	to = next_worker(worker);
+	d = 0;
+	add = 0;
+
+	__transaction_atomic {
+		count_attempt(worker);
+
+		if (u->e > 0 && u->h > v->h) {
+			if (u == e->u) {
+				d = MIN(u->e, e->c - e->f);
+				e->f += d;
+			} else {
+				d = MIN(u->e, e->c + e->f);
+				e->f -= d;
+			}
+
+			u->e -= d;
+			v->e += d;
+
+			if (d > 0 && !v->inQueue && v != g->s && v != g->t) {
+				v->inQueue = 1;
+				v->next = to->excess;
+				to->excess = v;
+				g->active += 1;
+				add = 1;
+			}
+		}
+
+		*left = u->e;
+	}
+
+	worker->commits += 1;
+
+	if (add)
+		unpark(to);
+
+	return d;
+}
+
+static void relabel(worker_t* worker, node_t* u)
+{
+	__transaction_atomic {
+		count_attempt(worker);
+		u->h = min_height(u);
+	}
+
+	worker->commits += 1;
+}
+
+static node_t* leave_excess(worker_t* worker)
+{
+	node_t*		u;
+
+	__transaction_atomic {
+		u = worker->excess;
+		if (u != NULL)
+			worker->excess = u->next;
+	}
+
+	return u;
+}
+
+static void done(worker_t* worker, node_t* u)
+{
+	int		last;
+
+	/* u stays ours if it got more excess while we discharged it. */
+
+	last = 0;
+
+	__transaction_atomic {
+		if (u->e > 0) {
+			u->next = worker->excess;
+			worker->excess = u;
+		} else {
+			u->inQueue = 0;
+			worker->g->active -= 1;
+			last = worker->g->active == 0;
+		}
+	}
+
+	if (last)
+		unpark_all(worker->g);
+}
+
+static int active(worker_t* worker)
+{
+	int		n;
+
+	__transaction_atomic {
+		n = worker->g->active;
+	}
+
+	return n;
+}
+
+#else
+
+static void lockNodes(node_t* u, node_t* v)
+{
+	/* the mutexes are not recursive, so the node of a self loop is
+	 * locked once. otherwise the node first in g->v is locked first.
+	 *
+	 */
+
+	if (u == v) {
+		pthread_mutex_lock(&u->nodeLock);
+	} else if (u < v) {
+		pthread_mutex_lock(&u->nodeLock);
+		pthread_mutex_lock(&v->nodeLock);
+	} else {
+		pthread_mutex_lock(&v->nodeLock);
+		pthread_mutex_lock(&u->nodeLock);
+	}
+}
+
+static void unlockNodes(node_t* u, node_t* v)
+{
+	pthread_mutex_unlock(&u->nodeLock);
+	if (v != u)
+		pthread_mutex_unlock(&v->nodeLock);
+}
+
+static void enter_excess(worker_t* worker, node_t* v)
+{
+	pthread_mutex_lock(&worker->excessMutex);
+	v->next = worker->excess;
+	worker->excess = v;
+	pthread_mutex_unlock(&worker->excessMutex);
+
+	unpark(worker);
+}
+
+static int push(worker_t* worker, node_t* u, node_t* v, edge_t* e, int* left)
+{
+	graph_t*	g = worker->g;
+	int		d;
+	int		add;
+
+	d = 0;
+	add = 0;
+
+	lockNodes(u, v);
+
+	if (u->e > 0 && u->h > v->h) {
+		if (u == e->u) {
+			d = MIN(u->e, e->c - e->f);
+			e->f += d;
+		} else {
+			d = MIN(u->e, e->c + e->f);
+			e->f -= d;
+		}
+
+		u->e -= d;
+		v->e += d;
+
+		/* counted before v can be taken from a list so that the
+		 * count never reaches zero too early.
+		 *
+		 */
+
+		if (d > 0 && !v->inQueue && v != g->s && v != g->t) {
+			v->inQueue = 1;
+			atomic_fetch_add((_Atomic int*) &g->active, 1);
+			add = 1;
+		}
+	}
+
+	*left = u->e;
+
+	unlockNodes(u, v);
+
+	if (add)
+		enter_excess(next_worker(worker), v);
+
+	return d;
+}
+
+static void relabel(worker_t* worker, node_t* u)
+{
+	/* nobody can push to or from u while we hold its lock, and
+	 * heights only grow so an old height of a neighbor is safe.
+	 *
+	 */
+
+	(void) worker;
+
+	pthread_mutex_lock(&u->nodeLock);
+	u->h = min_height(u);
+	pthread_mutex_unlock(&u->nodeLock);
+}
+
+static node_t* leave_excess(worker_t* worker)
+{
+	node_t*		u;
+
+	pthread_mutex_lock(&worker->excessMutex);
+	u = worker->excess;
+	if (u != NULL)
+		worker->excess = u->next;
+	pthread_mutex_unlock(&worker->excessMutex);
+
+	return u;
+}
+
+static void done(worker_t* worker, node_t* u)
+{
+	int		more;
+
+	pthread_mutex_lock(&u->nodeLock);
+	more = u->e > 0;
+	if (!more)
+		u->inQueue = 0;
+	pthread_mutex_unlock(&u->nodeLock);
+
+	if (more)
+		enter_excess(worker, u);
+	else if (atomic_fetch_sub((_Atomic int*) &worker->g->active, 1) == 1)
+		unpark_all(worker->g);
+}
+
+static int active(worker_t* worker)
+{
+	return atomic_load((_Atomic int*) &worker->g->active);
+}
+
+#endif
+
+static void *work(void* args)
+{
+	worker_t*	worker = (worker_t*) args;
+	node_t*		u;
+	node_t*		v;
+	edge_t*		e;
+	list_t*		p;
+	int		left;
+
+	for (;;) {
+		u = leave_excess(worker);
+
+		if (u == NULL) {
+			/* sleep until a node is given to us or the last node
+			 * has lost its excess. parked is set before we look
+			 * again, so whoever does either after that wakes us.
+			 *
+			 */
+
+			atomic_store(&worker->parked, 1);
+
+			u = leave_excess(worker);
+
+			if (u == NULL) {
+				if (active(worker) == 0)
+					return NULL;
+				futex_wait(&worker->parked, 1);
+				continue;
+			}
+
+			atomic_store(&worker->parked, 0);
+		}
+
+		pr("@T%d: discharge %d\n", worker->i, (int) (u - worker->g->v));
+
+		/* only we take excess from u, so it has some until a
+		 * push tells us otherwise. neighbors only move up and
+		 * only push to us from above, so if excess is left
+		 * after one scan no arc of u is admissible any more.
+		 *
+		 */
+
+		left = 1;
+
+		for (p = u->edge; p != NULL && left > 0; p = p->next) {
+			e = p->edge;
+			v = u == e->u ? e->v : e->u;
+			push(worker, u, v, e, &left);
+		}
+
+		if (left > 0)
+			relabel(worker, u);
+
+		done(worker, u);
+	}
+}
+
+int preflow(graph_t* g)
+{
+	node_t*		s;
+	node_t*		v;
+	edge_t*		e;
+	list_t*		p;
+	worker_t*	worker;
+	unsigned long	commits;
+	unsigned long	attempts;
+	unsigned long	serial;
+	int		nthreads = g->nthreads;
+	int		i;
+	pthread_t	thread[nthreads];
+	pthread_attr_t	attr;
+
+	s = g->s;
+	s->h = g->n;
+
+	/* start by pushing as much as possible (limited by
+	 * the edge capacity) from the source to its neighbors.
+	 * only this thread runs so no transactions are needed.
+	 *
+	 */
+
+	worker = &g->worker[0];
+
+	for (p = s->edge; p != NULL; p = p->next) {
+		e = p->edge;
+		v = s == e->u ? e->v : e->u;
+		s->e -= e->c;
+		v->e += e->c;
+		e->f += s == e->u ? e->c : -e->c;
+
+		if (!v->inQueue && v != g->t) {
+			v->inQueue = 1;
+			g->active += 1;
+			worker = next_worker(worker);
+			v->next = worker->excess;
+			worker->excess = v;
+		}
+	}
+
+	for (i = 0; i < nthreads; i += 1) {
+		thread_attr(&attr, i, nthreads);
+		if (pthread_create(&thread[i], &attr, work, (void *) &g->worker[i])) {
+			error("pthread_create failed");
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	for (i = 0; i < nthreads; i += 1) {
+		if (pthread_join(thread[i], NULL) != 0)  {
+			error("pthread_join failed");
+		}
+	}
+
+#if TM
+	commits = 0;
+	attempts = 0;
+	serial = 0;
+
+	for (i = 0; i < nthreads; i += 1) {
+		worker = &g->worker[i];
+		commits += worker->commits;
+		attempts += worker->attempts;
+		serial += worker->serial;
+	}
+
+	if (phase_verbose)
+		fprintf(stderr, "push and relabel transactions: %lu, aborts: %lu (%.2f%%), serial: %lu (%.2f%%)\n",
+			commits,
+			attempts - commits, attempts == 0 ? 0.0 : 100.0 * (attempts - commits) / attempts,
+			serial, attempts == 0 ? 0.0 : 100.0 * serial / attempts);
+#else
+	(void) commits;
+	(void) attempts;
+	(void) serial;
+#endif
+
+	return g->t->e;
+}
+
+static void free_graph(graph_t* g)
+{
+	int		i;
+	list_t*		p;
+	list_t*		q;
+
+#if !TM
+	for (i = 0; i < g->nthreads; i += 1)
+		pthread_mutex_destroy(&g->worker[i].excessMutex);
+
+	for (i = 0; i < g->n; i += 1)
+		pthread_mutex_destroy(&g->v[i].nodeLock);
+#endif
+
+	for (i = 0; i < g->n; i += 1) {
+		p = g->v[i].edge;
+		while (p != NULL) {
+			q = p->next;
+			free(p);
+			p = q;
+		}
+	}
+	free(g->worker);
+	free(g->v);
+	free(g->e);
+	free(g);
+}
+
+int main(int argc, char* argv[])
+{
+	FILE*		in;	/* input file set to stdin	*/
+	graph_t*	g;	/* undirected graph. 		*/
+	int		f;	/* output from preflow.		*/
+	int		n;	/* number of nodes.		*/
+	int		m;	/* number of edges.		*/
+
+	progname = argv[0];	/* name is a string in argv[0]. */
+
+	in = stdin;		/* same as System.in in Java.	*/
+
+	n = next_int();
+	m = next_int();
+
+	/* skip C and P from the 6railwayplanning lab in EDAF05 */
+	next_int();
+	next_int();
+
+	int nthreads = options(argc, argv);
+
+	init_timebase();
+
+	if (phase_verbose)
+		fprintf(stderr, "timebase: %s\n", timebase_name());
+
+	g = new_graph(n, m, nthreads);
+
+	fclose(in);
+
+	PHASE("solve") {
+		f = preflow(g);
+	}
+
+	printf("f = %d\n", f);
+
+	PHASE("teardown") {
+		free_graph(g);
+	}
+
+	return 0;
+}
@@ -0,0 +1,225 @@
+import argparse
+import csv
+import json
+import math
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+import bench
+
+# Run each parallel engine with 1, 2, 4, ... threads up to the number of
+# cpus on every input, and report the speedup and parallel efficiency
+# at each thread count. The thread count is set with PREFLOW_THREADS at
+# run time, so every engine is built once. The speedup is relative to
+# the fastest sequential engine on the same input, and not to the same
+# engine with one thread, which would hide what the parallel engine
+# costs with one thread. The efficiency is the speedup divided by the
+# threads.
+#
+# By default the solve phase the engines print with -v is compared,
+# since reading the input is serial in all of them, and with --phase
+# wall the wall time of the whole process is compared instead. The
+# forsete engines build the graph in their solve phase, since their
+# preflow() is given the edges, so they are always compared on the
+# wall time against the wall time of the base, and marked "(wall)".
+# The flow is checked against the .ans file as in bench.py. A table
+# is printed with one line per engine, input and thread count, then
+# the geometric mean of the speedups of each engine and thread count
+# over the inputs. --csv writes the same lines in a form to plot, and
+# --json everything.
+#
+# usage: python3 scaling.py [-e engine,...] [-s engine,...] [-d glob,...]
+#                           [--threads n,...] [--max n] [--phase name]
+#                           [-w warmup] [-n trials] [--timeout s]
+#                           [--csv file] [--json file] [-- engine args]
+#
+# e.g. python3 scaling.py -e lab3,lab4 -d "big/*.in" --csv scaling.csv
+
+sequential = ["lab0"]
+
+# engines whose solve phase includes building the graph
+build_in_solve = ["forsete", "forsete-atomic"]
+
+
+def thread_counts(most):
+    # 1, 2, 4, ... and most itself if it is not a power of two
+    ts = []
+    t = 1
+    while t < most:
+        ts.append(t)
+        t *= 2
+    ts.append(most)
+    return ts
+
+
+def median(r, phase):
+    p = r["phases"].get(phase)
+    if r["status"] != "ok" or p is None:
+        return None
+    return p["median"]
+
+
+def geomean(xs):
+    xs = [x for x in xs if x is not None and x > 0]
+    if not xs:
+        return None
+    return math.exp(sum(math.log(x) for x in xs) / len(xs))
+
+
+def fmt(x, f="%.2f"):
+    return "-" if x is None else f % x
+
+
+def cell(x, f):
+    # An empty CSV cell for a missing number, which plots as a gap
+    return "" if x is None else f % x
+
+
+def main():
+    parallel = [e for e in bench.engines if e not in sequential]
+
+    parser = argparse.ArgumentParser(description="measure how the preflow engines scale")
+    parser.add_argument("-e", "--engines", default=",".join(parallel),
+                        help="comma separated parallel engines (default %(default)s)")
+    parser.add_argument("-s", "--sequential", default=",".join(sequential),
+                        help="sequential engines, the fastest is the base (default %(default)s)")
+    parser.add_argument("-d", "--data", default="big/*.in,skew/*.in",
+                        help="comma separated globs under data (default %(default)s)")
+    parser.add_argument("--threads", help="comma separated thread counts (default 1, 2, 4, ... --max)")
+    parser.add_argument("--max", type=int, default=os.cpu_count() or 1,
+                        help="most threads (default the cpus, %(default)s)")
+    parser.add_argument("--phase", default="solve",
+                        help="phase to compare, e.g. solve or wall (default %(default)s)")
+    parser.add_argument("-w", "--warmup", type=int, default=1, help="untimed runs first")
+    parser.add_argument("-n", "--trials", type=int, default=5, help="timed runs")
+    parser.add_argument("--timeout", type=float, default=60, help="seconds per run")
+    parser.add_argument("--csv", help="write one row per engine, input and threads to this file")
+    parser.add_argument("--json", help="write the results as JSON to this file")
+    parser.add_argument("args", nargs="*", help="more arguments for every engine, after --")
+    args = parser.parse_args()
+    args.perf = False
+
+    names = args.engines.split(",")
+    bases = args.sequential.split(",")
+    for name in names + bases:
+        if name not in bench.engines:
+            parser.error("unknown engine %s: use %s" % (name, ",".join(bench.engines)))
+
+    if args.threads is not None:
+        threads = [int(t) for t in args.threads.split(",")]
+    else:
+        threads = thread_counts(max(1, args.max))
+
+    paths = bench.inputs(args.data.split(","))
+    if not paths:
+        parser.error("no inputs match %s" % args.data)
+
+    outdir = tempfile.mkdtemp(prefix="scaling")
+    results = []
+    rows = []
+    speedups = {name: {t: [] for t in threads} for name in names}
+
+    try:
+        exes = {}
+        for name in bases + names:
+            exe = bench.build(name, outdir, False)
+            if exe is not None:
+                exes[name] = exe
+
+        print("%-15s %-32s %7s %-10s %12s %8s %10s" % (
+            "engine", "input", "threads", "status", args.phase + " ms", "speedup", "efficiency"))
+
+        for path in paths:
+            # The fastest sequential engine which finished is the base
+            args.threads = None
+            base = None
+            base_ms = None
+            base_wall = None
+            for name in bases:
+                if name not in exes:
+                    continue
+                r = bench.bench(name, exes[name], path, args)
+                results.append(r)
+                ms = median(r, args.phase)
+                print("%-15s %-32s %7s %-10s %12s" % (
+                    name, r["input"], "-", r["status"], fmt(ms, "%.3f")), flush=True)
+                if ms is not None and (base_ms is None or ms < base_ms):
+                    base = name
+                    base_ms = ms
+                    base_wall = median(r, "wall")
+
+            for name in names:
+                if name not in exes:
+                    continue
+                phase = "wall" if name in build_in_solve else args.phase
+                base_phase_ms = base_wall if phase != args.phase else base_ms
+                for t in threads:
+                    args.threads = t
+                    r = bench.bench(name, exes[name], path, args)
+                    ms = median(r, phase)
+                    speedup = base_phase_ms / ms if base_phase_ms is not None and ms else None
+                    efficiency = speedup / t if speedup is not None else None
+
+                    r["phase"] = phase
+                    r["base"] = base
+                    r["speedup"] = speedup
+                    r["efficiency"] = efficiency
+                    results.append(r)
+                    speedups[name][t].append(speedup)
+
+                    rows.append([name, r["input"], t, r["status"], phase,
+                                 cell(ms, "%.3f"), base or "", cell(base_phase_ms, "%.3f"),
+                                 cell(speedup, "%.4f"), cell(efficiency, "%.4f")])
+
+                    print("%-15s %-32s %7d %-10s %12s %8s %10s%s" % (
+                        name, r["input"], t, r["status"], fmt(ms, "%.3f"),
+                        fmt(speedup), fmt(efficiency),
+                        " (wall)" if phase != args.phase else ""), flush=True)
+    finally:
+        shutil.rmtree(outdir)
+
+    summary = {}
+    print()
+    print("%-15s %7s %8s %10s   (geometric mean over the inputs)" % (
+        "engine", "threads", "speedup", "efficiency"))
+    for name in names:
+        summary[name] = {}
+        for t in threads:
+            s = geomean(speedups[name][t])
+            summary[name][t] = s
+            print("%-15s %7d %8s %10s%s" % (name, t, fmt(s), fmt(s / t if s is not None else None),
+                                            " (wall)" if name in build_in_solve and args.phase != "wall" else ""))
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            w = csv.writer(f)
+            w.writerow(["engine", "input", "threads", "status", "phase", "median_ms",
+                        "base", "base_ms", "speedup", "efficiency"])
+            w.writerows(rows)
+
+    report = {
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "commit": bench.git_commit(),
+        "cpus": os.cpu_count(),
+        "phase": args.phase,
+        "threads": threads,
+        "warmup": args.warmup,
+        "trials": args.trials,
+        "summary": summary,
+        "results": results,
+    }
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+
+    failed = [r for r in results if r["status"] != "ok"]
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
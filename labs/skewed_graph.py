@@ -0,0 +1,40 @@
+import random
+import sys
+
+# Write a flow network where a few hub nodes have most of the arcs, in
+# the input format of the labs: "n m 0 0" and then one "a b c" line
+# per edge. The source 0 feeds the hubs, each hub fans out to many
+# middle nodes, and the middle nodes pass the flow on through a sparse
+# random graph to the sink n-1. Every unit of flow must leave through
+# a hub, so a hub stays active with a large excess for many rounds.
+#
+# usage: python3 skewed_graph.py [n] [hubs] [hub_degree] [seed] > out.in
+
+n = int(sys.argv[1]) if len(sys.argv) > 1 else 50000
+hubs = int(sys.argv[2]) if len(sys.argv) > 2 else 2
+hub_degree = int(sys.argv[3]) if len(sys.argv) > 3 else 50000
+seed = int(sys.argv[4]) if len(sys.argv) > 4 else 1
+
+random.seed(seed)
+
+edges = []
+
+# Hubs are nodes 1..hubs, the rest except the sink are middle nodes
+first = hubs + 1
+sink = n - 1
+
+for h in range(1, hubs + 1):
+    edges.append((0, h, random.randint(hub_degree, 4 * hub_degree)))
+    for _ in range(hub_degree):
+        edges.append((h, random.randint(first, sink - 1), random.randint(1, 10)))
+
+for v in range(first, sink):
+    for _ in range(3):
+        edges.append((v, random.randint(first, sink - 1), random.randint(1, 10)))
+    if random.random() < 0.1:
+        edges.append((v, sink, random.randint(10, 100)))
+
+out = sys.stdout
+out.write("%d %d 0 0\n" % (n, len(edges)))
+for a, b, c in edges:
+    out.write("%d %d %d\n" % (a, b, c))